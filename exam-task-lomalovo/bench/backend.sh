@@ -0,0 +1,50 @@
+#!/bin/sh
+# Worker startup latency and total time of the clone backend against
+# the fork backend, parallelism 1..20.
+#
+# usage: bench/backend.sh [files.txt]
+# Without a list, COUNT files of SIZE bytes are generated in WORKDIR.
+# env:   COUNT, SIZE, RUNS, WORKDIR
+
+set -e
+
+cd "$(dirname "$0")/.."
+
+COUNT=${COUNT:-200}
+SIZE=${SIZE:-1048576}
+RUNS=${RUNS:-5}
+WORKDIR=${WORKDIR:-/tmp/summer-backend}
+
+mkdir -p "$WORKDIR"
+cc -O2 -o "$WORKDIR/summer" main.c
+
+LIST=$1
+if [ -z "$LIST" ]; then
+    LIST=$WORKDIR/files.txt
+    : > "$LIST"
+    i=0
+    while [ $i -lt "$COUNT" ]; do
+        [ -f "$WORKDIR/data$i" ] || yes 123456 | head -c "$SIZE" > "$WORKDIR/data$i"
+        echo "$WORKDIR/data$i" >> "$LIST"
+        i=$((i + 1))
+    done
+fi
+
+# median over $RUNS runs of "startup-avg-us startup-max-us total-ms"
+measure() {
+    r=0
+    while [ $r -lt "$RUNS" ]; do
+        "$WORKDIR/summer" "$LIST" "$1" --timing --backend="$2" 2>&1 > /dev/null |
+            awk '{ print $5, $8, $11 }'
+        r=$((r + 1))
+    done | sort -n -k3 | awk -v n="$RUNS" 'NR == int((n + 1) / 2)'
+}
+
+printf "%3s | %-28s | %-28s\n" p "fork: start-avg/max us, ms" "clone: start-avg/max us, ms"
+p=1
+while [ $p -le 20 ]; do
+    f=$(measure $p fork)
+    c=$(measure $p clone)
+    printf "%3d | %-28s | %-28s\n" $p "$f" "$c"
+    p=$((p + 1))
+done
@@ -0,0 +1,261 @@
+// Synthetic inputs for the summer: COUNT data files with sizes drawn from
+// a distribution, the list file naming them, and the expected sum on
+// stdout so that any run over the list can be checked.
+//
+// usage: gen <dir> [--count=N] [--dist=SPEC] [--width=MIN-MAX] [--negative]
+//            [--seed=N]
+//
+//   --dist=uniform:MIN-MAX        sizes uniform in [MIN, MAX] (default 4K-1M)
+//   --dist=zipf:S:MAX             the k-th largest file has MAX / k^S bytes
+//   --dist=mix:NxSIZE[,NxSIZE...] N files of SIZE each, e.g. 1000x1M,2x1G
+//                                 (the count comes from the spec)
+//   --width=MIN-MAX               decimal digits per number (1..10, default 1-9);
+//                                 10-digit numbers stop at INT_MAX
+//   --negative                    every number is negative with probability 1/2
+//
+// Sizes take K, M and G suffixes. Files are written as <dir>/data<i>, the
+// list as <dir>/list.txt in shuffled order, so that the input order says
+// nothing about the sizes.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define MAX_FILES 10000
+#define MAX_PATH_LEN 200
+#define OUT_BUFFER_SIZE (1 << 20)
+
+typedef enum {
+    DIST_UNIFORM,
+    DIST_ZIPF,
+    DIST_MIX
+} Dist;
+
+typedef struct {
+    int count;
+    Dist dist;
+    long long min, max;
+    double zipf_s;
+    const char *mix;
+    int width_min, width_max;
+    int negative;
+    unsigned long long seed;
+} Options;
+
+Options options = {100, DIST_UNIFORM, 4 << 10, 1 << 20, 1.0, NULL, 1, 9, 0, 1};
+
+// xorshift64*: plenty for test data and much faster than rand()
+unsigned long long rng_state;
+
+unsigned long long next_random(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ULL;
+}
+
+long long random_between(long long lo, long long hi) {
+    return lo + (long long)(next_random() % (unsigned long long)(hi - lo + 1));
+}
+
+void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s <dir> [--count=N]"
+                    " [--dist=uniform:MIN-MAX|zipf:S:MAX|mix:NxSIZE[,NxSIZE...]]"
+                    " [--width=MIN-MAX] [--negative] [--seed=N]\n", prog);
+    exit(1);
+}
+
+// "64", "4K", "1M", "2G"; returns -1 on garbage
+long long parse_size(const char *s, char **end) {
+    long long value = strtoll(s, end, 10);
+    if (*end == s || value < 0) {
+        return -1;
+    }
+    switch (**end) {
+    case 'K': case 'k': value <<= 10; (*end)++; break;
+    case 'M': case 'm': value <<= 20; (*end)++; break;
+    case 'G': case 'g': value <<= 30; (*end)++; break;
+    }
+    return value;
+}
+
+// Fills sizes[] according to the options and returns the file count.
+int make_sizes(long long sizes[]) {
+    if (options.dist == DIST_MIX) {
+        int count = 0;
+        const char *s = options.mix;
+        while (*s) {
+            char *end;
+            long n = strtol(s, &end, 10);
+            if (end == s || *end != 'x') {
+                return -1;
+            }
+            long long size = parse_size(end + 1, &end);
+            if (size < 0 || n < 0 || count + n > MAX_FILES) {
+                return -1;
+            }
+            for (long i = 0; i < n; i++) {
+                sizes[count++] = size;
+            }
+            s = *end == ',' ? end + 1 : end;
+            if (*end && *end != ',') {
+                return -1;
+            }
+        }
+        return count;
+    }
+
+    for (int i = 0; i < options.count; i++) {
+        if (options.dist == DIST_ZIPF) {
+            sizes[i] = (long long)(options.max / pow(i + 1, options.zipf_s));
+        } else {
+            sizes[i] = random_between(options.min, options.max);
+        }
+    }
+    return options.count;
+}
+
+// Writes whole lines until at least size bytes are out; returns their sum
+// the way the summer sees it, i.e. every number as an int.
+long write_numbers(FILE *file, long long size, char *buffer) {
+    static const long long powers[] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000,
+                                       100000000, 1000000000, 10000000000};
+    long total = 0;
+    long long written = 0;
+    size_t used = 0;
+    while (written < size) {
+        int width = random_between(options.width_min, options.width_max);
+        long long hi = powers[width] - 1 < INT_MAX ? powers[width] - 1 : INT_MAX;
+        int value = random_between(width == 1 ? 0 : powers[width - 1], hi);
+        if (options.negative && (next_random() & 1)) {
+            value = -value;
+        }
+        if (used > OUT_BUFFER_SIZE - 16) {
+            fwrite(buffer, 1, used, file);
+            used = 0;
+        }
+        int n = sprintf(buffer + used, "%d\n", value);
+        used += n;
+        written += n;
+        total += value;
+    }
+    fwrite(buffer, 1, used, file);
+    return total;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        usage(argv[0]);
+    }
+    const char *dir = argv[1];
+
+    for (int i = 2; i < argc; i++) {
+        char *end;
+        if (strncmp(argv[i], "--count=", 8) == 0) {
+            options.count = atoi(argv[i] + 8);
+            if (options.count < 1 || options.count > MAX_FILES) {
+                usage(argv[0]);
+            }
+        } else if (strncmp(argv[i], "--dist=uniform:", 15) == 0) {
+            options.dist = DIST_UNIFORM;
+            options.min = parse_size(argv[i] + 15, &end);
+            if (options.min < 0 || *end != '-') {
+                usage(argv[0]);
+            }
+            options.max = parse_size(end + 1, &end);
+            if (options.max < options.min || *end) {
+                usage(argv[0]);
+            }
+        } else if (strncmp(argv[i], "--dist=zipf:", 12) == 0) {
+            options.dist = DIST_ZIPF;
+            options.zipf_s = strtod(argv[i] + 12, &end);
+            if (*end != ':') {
+                usage(argv[0]);
+            }
+            options.max = parse_size(end + 1, &end);
+            if (options.max < 0 || *end) {
+                usage(argv[0]);
+            }
+        } else if (strncmp(argv[i], "--dist=mix:", 11) == 0) {
+            options.dist = DIST_MIX;
+            options.mix = argv[i] + 11;
+        } else if (strncmp(argv[i], "--width=", 8) == 0) {
+            if (sscanf(argv[i] + 8, "%d-%d", &options.width_min, &options.width_max) != 2 ||
+                options.width_min < 1 || options.width_max > 10 ||
+                options.width_min > options.width_max) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(argv[i], "--negative") == 0) {
+            options.negative = 1;
+        } else if (strncmp(argv[i], "--seed=", 7) == 0) {
+            options.seed = strtoull(argv[i] + 7, NULL, 10);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    rng_state = options.seed ? options.seed : 1;
+
+    static long long sizes[MAX_FILES];
+    int count = make_sizes(sizes);
+    if (count < 1) {
+        fprintf(stderr, "Bad --dist spec\n");
+        exit(1);
+    }
+
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        perror("Error creating output directory");
+        exit(1);
+    }
+
+    char *buffer = malloc(OUT_BUFFER_SIZE);
+    if (!buffer) {
+        perror("Error allocating output buffer");
+        exit(1);
+    }
+
+    // Fisher-Yates over the names, so big files don't come first
+    static int order[MAX_FILES];
+    for (int i = 0; i < count; i++) {
+        order[i] = i;
+    }
+    for (int i = count - 1; i > 0; i--) {
+        int j = random_between(0, i);
+        int t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+
+    char path[MAX_PATH_LEN];
+    snprintf(path, sizeof(path), "%s/list.txt", dir);
+    FILE *list = fopen(path, "w");
+    if (!list) {
+        perror("Error creating list file");
+        exit(1);
+    }
+
+    long total = 0;
+    long long bytes = 0;
+    for (int i = 0; i < count; i++) {
+        snprintf(path, sizeof(path), "%s/data%d", dir, order[i]);
+        FILE *file = fopen(path, "w");
+        if (!file) {
+            perror("Error creating data file");
+            exit(1);
+        }
+        total += write_numbers(file, sizes[order[i]], buffer);
+        bytes += sizes[order[i]];
+        fclose(file);
+        fprintf(list, "%s\n", path);
+    }
+    fclose(list);
+    free(buffer);
+
+    fprintf(stderr, "%d files, %.1f MB\n", count, bytes / (1024.0 * 1024.0));
+    printf("sum: %ld\n", total);
+    return 0;
+}
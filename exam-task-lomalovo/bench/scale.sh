@@ -0,0 +1,104 @@
+#!/bin/sh
+# Speedup curve of the summer over parallelism 1..20: wall time, CPU time
+# (user + sys of the whole process tree) and speedup against the first
+# level (p=1 by default), on a dataset made by bench/gen.c. Each run's sum
+# is checked against the one the generator printed; a run that fails or
+# gets another sum stops the script with status 1, naming the level.
+#
+# usage: bench/scale.sh [uniform|zipf|giants|LIST] [summer flags...]
+# A LIST of your own must name its files by absolute path.
+# env:   LEVELS, RUNS, WORKDIR, GEN_FLAGS (extra flags for gen)
+#
+# Presets: uniform = 1000 files of 4K-4M, zipf = 1000 files with s=1 and
+# a 256M head, giants = 1000x1M + 2x1G. Datasets are generated once per
+# WORKDIR and reused. A CSV copy of the table goes to $WORKDIR/scale.csv.
+
+set -e
+
+cd "$(dirname "$0")/.."
+
+DATASET=${1:-uniform}
+[ $# -gt 0 ] && shift
+LEVELS=${LEVELS:-$(seq 1 20)}
+RUNS=${RUNS:-3}
+WORKDIR=${WORKDIR:-/tmp/summer-scale}
+
+mkdir -p "$WORKDIR"
+cc -O2 -o "$WORKDIR/summer" main.c
+cc -O2 -o "$WORKDIR/gen" bench/gen.c -lm
+
+case $DATASET in
+uniform) spec="--count=1000 --dist=uniform:4K-4M" ;;
+zipf)    spec="--count=1000 --dist=zipf:1:256M" ;;
+giants)  spec="--dist=mix:1000x1M,2x1G" ;;
+*)       spec= ;;
+esac
+
+if [ -n "$spec" ]; then
+    DATA=$WORKDIR/$DATASET
+    LIST=$DATA/list.txt
+    if [ ! -f "$DATA/expected" ]; then
+        # shellcheck disable=SC2086
+        "$WORKDIR/gen" "$DATA" $spec $GEN_FLAGS > "$DATA.expected"
+        mv "$DATA.expected" "$DATA/expected"
+    fi
+    expected=$(cat "$DATA/expected")
+else
+    LIST=$DATASET
+    expected=
+fi
+
+# best of $RUNS as "wall-ms cpu-ms", or "wrong" if any run failed or got
+# the wrong sum; the CPU time comes from the shell's children totals, read
+# before and after each run
+measure() {
+    r=0
+    while [ $r -lt "$RUNS" ]; do
+        (
+            start=$(date +%s%N)
+            if ! out=$("$WORKDIR/summer" "$LIST" "$@"); then
+                echo "p=$1: the summer failed" >&2
+                echo wrong
+                exit 1
+            fi
+            end=$(date +%s%N)
+            if [ -n "$expected" ] && [ "$out" != "$expected" ]; then
+                echo "p=$1: got '$out', expected '$expected'" >&2
+                echo wrong
+                exit 1
+            fi
+            echo "$(((end - start) / 1000000))"
+            times
+        ) | awk 'NR == 1 && $1 == "wrong" { print; exit }
+                 NR == 1 { wall = $1 }
+                 NR == 3 { print wall, cpu($1) + cpu($2) }
+                 function cpu(t,  m) {
+                     m = index(t, "m")
+                     return (substr(t, 1, m - 1) * 60 + substr(t, m + 1) + 0) * 1000
+                 }'
+        r=$((r + 1))
+    done | awk '$1 == "wrong" { wrong = 1 }
+                $1 != "wrong" && (n++ == 0 || $1 < best) { best = $1; line = $0 }
+                END { print wrong || !n ? "wrong" : line }'
+}
+
+printf "%4s %10s %10s %8s %10s\n" p wall_ms cpu_ms speedup efficiency
+echo "p,wall_ms,cpu_ms,speedup,efficiency" > "$WORKDIR/scale.csv"
+base=
+for p in $LEVELS; do
+    set -- "$p" "$@"
+    m=$(measure "$@")
+    shift
+    if [ "$m" = wrong ]; then
+        echo "scale.sh: $DATASET, p=$p${*:+, flags $*}: a run failed or got the wrong sum" >&2
+        exit 1
+    fi
+    wall=${m% *}
+    cpu=${m#* }
+    [ -n "$base" ] || base=$wall
+    line=$(awk -v b="$base" -v w="$wall" -v c="$cpu" -v p="$p" \
+        'BEGIN { s = b / (w ? w : 1); printf "%d %d %d %.2f %.2f", p, w, c, s, s / p }')
+    # shellcheck disable=SC2086
+    printf "%4d %10d %10d %8s %10s\n" $line
+    echo "$line" | tr ' ' ',' >> "$WORKDIR/scale.csv"
+done
@@ -0,0 +1,95 @@
+#!/bin/sh
+# Makespan of the shared work queue (--sched=queue) and the work-stealing
+# deques (--sched=steal) against the old static snake split
+# (--sched=static) on skewed file-size distributions.
+#
+# usage: bench/sched.sh [parallelism...]        (default: 4 8 20)
+# env:   SMALL_COUNT, SMALL_SIZE, BIG_COUNT, BIG_SIZE, RUNS, WORKDIR
+
+set -e
+
+cd "$(dirname "$0")/.."
+
+SMALL_COUNT=${SMALL_COUNT:-200}
+SMALL_SIZE=${SMALL_SIZE:-1048576}
+BIG_COUNT=${BIG_COUNT:-2}
+BIG_SIZE=${BIG_SIZE:-268435456}
+RUNS=${RUNS:-3}
+WORKDIR=${WORKDIR:-/tmp/summer-sched}
+LEVELS=${*:-"4 8 20"}
+
+cc -O2 -o "$WORKDIR.bin" main.c
+
+# "numbers" of size $2 into file $1; every line is "${3:-123456}\n" except maybe the last
+mkdata() {
+    yes "${3:-123456}" | head -c "$2" > "$1"
+}
+
+mkdir -p "$WORKDIR"
+
+# skewed: many small files plus a couple of giants
+: > "$WORKDIR/skewed.txt"
+i=0
+while [ $i -lt "$BIG_COUNT" ]; do
+    [ -f "$WORKDIR/big$i" ] || mkdata "$WORKDIR/big$i" "$BIG_SIZE"
+    echo "$WORKDIR/big$i" >> "$WORKDIR/skewed.txt"
+    i=$((i + 1))
+done
+i=0
+while [ $i -lt "$SMALL_COUNT" ]; do
+    [ -f "$WORKDIR/small$i" ] || mkdata "$WORKDIR/small$i" "$SMALL_SIZE"
+    echo "$WORKDIR/small$i" >> "$WORKDIR/skewed.txt"
+    i=$((i + 1))
+done
+
+# ramp: sizes grow linearly, SMALL_SIZE * k for k = 1..SMALL_COUNT/4
+: > "$WORKDIR/ramp.txt"
+i=1
+while [ $i -le $((SMALL_COUNT / 4)) ]; do
+    [ -f "$WORKDIR/ramp$i" ] || mkdata "$WORKDIR/ramp$i" $((SMALL_SIZE * i))
+    echo "$WORKDIR/ramp$i" >> "$WORKDIR/ramp.txt"
+    i=$((i + 1))
+done
+
+# digits: equal sizes, but every other file has 1-digit numbers, i.e.
+# 3.5x the numbers per byte, so bytes alone misjudge the cost
+: > "$WORKDIR/digits.txt"
+i=0
+while [ $i -lt "$SMALL_COUNT" ]; do
+    if [ $((i % 2)) -eq 0 ]; then
+        [ -f "$WORKDIR/short$i" ] || mkdata "$WORKDIR/short$i" "$SMALL_SIZE" 1
+        echo "$WORKDIR/short$i" >> "$WORKDIR/digits.txt"
+    else
+        echo "$WORKDIR/small$i" >> "$WORKDIR/digits.txt"
+    fi
+    i=$((i + 1))
+done
+
+# best wall time of $RUNS runs, in milliseconds
+makespan() {
+    best=
+    r=0
+    while [ $r -lt "$RUNS" ]; do
+        start=$(date +%s%N)
+        "$WORKDIR.bin" "$@" > /dev/null
+        end=$(date +%s%N)
+        t=$(((end - start) / 1000000))
+        if [ -z "$best" ] || [ "$t" -lt "$best" ]; then
+            best=$t
+        fi
+        r=$((r + 1))
+    done
+    echo "$best"
+}
+
+printf "%-8s %4s %10s %10s %10s %8s\n" dataset p static_ms queue_ms steal_ms speedup
+for set in skewed ramp digits; do
+    for p in $LEVELS; do
+        s=$(makespan "$WORKDIR/$set.txt" "$p" --sched=static)
+        q=$(makespan "$WORKDIR/$set.txt" "$p" --sched=queue)
+        w=$(makespan "$WORKDIR/$set.txt" "$p" --sched=steal)
+        best=$((q < w ? q : w))
+        printf "%-8s %4d %10d %10d %10d %8s\n" "$set" "$p" "$s" "$q" "$w" \
+            "$(awk "BEGIN { printf \"%.2f\", $s / ($best ? $best : 1) }")"
+    done
+done
@@ -1,81 +1,1357 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+
+#ifdef __linux__
+#include <sched.h>
+#define HAVE_CLONE 1
+#endif
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#undef BLOCK_SIZE  // linux/fs.h, pulled in by io_uring.h, has its own
+#define HAVE_IO_URING 1
+#endif
+
+#ifdef __SSE2__
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
 
 #define MAX_FILES 10000
 #define MAX_FILENAME_LEN 200
+#define BLOCK_SIZE (1 << 20)
+#define MIN_SPLIT_SIZE (1 << 20)
+#define WORKER_STACK_SIZE (256 * 1024)
+#define MAX_PARALLELISM 20
+#define URING_DEPTH 4
 
 typedef struct {
     char *filename;
     off_t size;
 } FileInfo;
 
+// A unit of work: the whole file or a newline-aligned byte range of it.
+typedef struct {
+    int file;
+    off_t offset;
+    off_t length;
+} Task;
+
+typedef enum {
+    SCHED_QUEUE,
+    SCHED_STATIC,
+    SCHED_STEAL
+} SchedMode;
+
+typedef enum {
+    IO_READ,
+    IO_STDIO,
+    IO_MMAP,
+    IO_URING
+} IoEngine;
+
+typedef enum {
+    BACKEND_FORK,
+    BACKEND_CLONE
+} Backend;
+
+typedef struct {
+    SchedMode sched;
+    Backend backend;
+    IoEngine io;
+    int scalar;
+    off_t split;    // 0: files are indivisible, -1: pick the range size automatically
+    int bench;
+    int timing;
+    int stream;
+    int stats;
+} Options;
+
+Options options = {SCHED_QUEUE, BACKEND_FORK, IO_READ, 0, 0, 0, 0, 0, 0};
+
+// Chase-Lev deque of task indices for --sched=steal. The owner pops at
+// the bottom, thieves CAS the top. Nothing is pushed once the workers
+// run, so the items are a fixed slice [base, base + initial bottom) of
+// one shared array and the deque never grows.
+typedef struct {
+    _Alignas(64) long top;
+    _Alignas(64) long bottom;
+    int base;
+} Deque;
+
+// Lives in an anonymous MAP_SHARED mapping, so every forked worker
+// sees the same counter and claims tasks from it one by one. With
+// --sched=steal the workers use the per-worker deques instead.
+typedef struct {
+    int next;
+    int *items;
+    Deque deques[MAX_PARALLELISM];
+} WorkQueue;
+
+// What a worker did, for --stats. Idle time is everything that is not
+// spent inside sum(): claiming, waiting for names, stat(), startup.
+typedef struct {
+    long tasks;
+    long bytes;
+    long numbers;
+    long steals;
+    double busy_ms;
+    double total_ms;
+} WorkerStats;
+
+// Per-worker result slot, padded to whole cache lines so that workers
+// finishing at the same time never write to the same line. Shared with
+// the coordinator either through MAP_SHARED (fork) or the common address
+// space (clone).
+typedef struct {
+    _Alignas(64) long sum;
+    double started_ms;
+    WorkerStats stats;
+} WorkerSlot;
+
+// Biggest tasks first: with dynamic claiming this is the LPT order,
+// the giants start early and small files fill the gaps at the end.
 int compare(const void *a, const void *b) {
-    FileInfo *fileA = (FileInfo *)a;
-    FileInfo *fileB = (FileInfo *)b;
-    return (fileA->size - fileB->size);
+    const Task *taskA = (const Task *)a;
+    const Task *taskB = (const Task *)b;
+    if (taskA->length != taskB->length) {
+        return taskA->length < taskB->length ? 1 : -1;
+    }
+    return 0;
+}
+
+// Smallest tasks first, the baseline's order: --sched=static deals
+// them out along the snake of static_owner() as the baseline did.
+int compare_ascending(const void *a, const void *b) {
+    return compare(b, a);
 }
 
-void sum(const char *filename, long *result) {
+// Reference path: one fgets() + atoi() per line.
+long sum_stdio(const char *filename, off_t offset, off_t length, long *numbers) {
     FILE *file = fopen(filename, "r");
     if (!file) {
         perror("Error opening file");
         exit(1);
     }
+    if (offset > 0 && fseeko(file, offset, SEEK_SET) != 0) {
+        perror("Error seeking file");
+        exit(1);
+    }
+
+    // ftello() per line is not free, so only ranges that stop short of
+    // the end of the file pay for the check.
+    struct stat st;
+    off_t end = offset + length;
+    int bounded = fstat(fileno(file), &st) == 0 && end < st.st_size;
 
     char buffer[MAX_FILENAME_LEN];
     long sum = 0;
-    while (fgets(buffer, MAX_FILENAME_LEN, file)) {
+    while ((!bounded || ftello(file) < end) && fgets(buffer, MAX_FILENAME_LEN, file)) {
         sum += atoi(buffer);
+        (*numbers)++;
     }
     fclose(file);
-    *result = sum;
+    return sum;
 }
 
-void process(FileInfo files[], int n, int p, int parallelism, int pipe_fd) {
-    long total_sum = 0;
-    int incr=0;
+enum {
+    LINE_START,
+    LINE_SIGN,
+    LINE_NUMBER,
+    LINE_SKIP
+};
+
+// Streaming version of atoi() applied to every line: leading blanks, an
+// optional sign, digits, and the rest of the line up to '\n' is ignored.
+// The state survives between blocks, so a number may be split anywhere.
+typedef struct {
+    long sum;
+    long numbers;
+    long value;
+    int negative;
+    int state;
+} Parser;
+
+void parser_commit(Parser *ps) {
+    ps->sum += (int)(ps->negative ? -ps->value : ps->value);
+    ps->numbers++;
+    ps->value = 0;
+    ps->negative = 0;
+}
+
+// Scalar state machine. Consumes bytes from buf[i..n) and stops right
+// after the first '\n'. Returns the position it stopped at.
+size_t parse_line_scalar(Parser *ps, const char *buf, size_t i, size_t n) {
+    while (i < n) {
+        char c = buf[i++];
+        if (c == '\n') {
+            if (ps->state == LINE_NUMBER) {
+                parser_commit(ps);
+            }
+            ps->value = 0;
+            ps->negative = 0;
+            ps->state = LINE_START;
+            return i;
+        }
+        int digit = c >= '0' && c <= '9';
+        switch (ps->state) {
+        case LINE_START:
+            if (digit) {
+                ps->value = c - '0';
+                ps->state = LINE_NUMBER;
+            } else if (c == '-' || c == '+') {
+                ps->negative = c == '-';
+                ps->state = LINE_SIGN;
+            } else if (c != ' ' && c != '\t' && c != '\r' && c != '\v' && c != '\f') {
+                ps->state = LINE_SKIP;
+            }
+            break;
+        case LINE_SIGN:
+            if (digit) {
+                ps->value = c - '0';
+                ps->state = LINE_NUMBER;
+            } else {
+                ps->state = LINE_SKIP;
+            }
+            break;
+        case LINE_NUMBER:
+            if (digit) {
+                ps->value = ps->value * 10 + (c - '0');
+            } else {
+                parser_commit(ps);
+                ps->state = LINE_SKIP;
+            }
+            break;
+        }
+    }
+    return i;
+}
+
+void parser_finish(Parser *ps) {
+    if (ps->state == LINE_NUMBER) {
+        parser_commit(ps);
+    }
+    ps->state = LINE_START;
+}
+
+#ifdef HAVE_X86_SIMD
+// Folds 1..8 ASCII digits into their value without a per-digit loop:
+// the digits are shifted to the top of a little-endian word (so the
+// missing ones read as leading zeros) and combined pairwise, 8 -> 4 -> 2 -> 1.
+static inline uint64_t fold_digits(const char *p, int len) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    v <<= 8 * (8 - len);
+    v = ((v & 0x0F0F0F0F0F0F0F0FULL) * 2561) >> 8;
+    v = ((v & 0x00FF00FF00FF00FFULL) * 6553601) >> 16;
+    return ((v & 0x0000FFFF0000FFFFULL) * 42949672960001ULL) >> 32;
+}
+
+static inline void classify_sse2(const char *p, uint64_t *digits, uint64_t *newlines) {
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    __m128i d = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+    __m128i is_digit = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d);
+    *digits = (uint32_t)_mm_movemask_epi8(is_digit);
+    *newlines = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+}
+
+__attribute__((target("avx2")))
+static inline void classify_avx2(const char *p, uint64_t *digits, uint64_t *newlines) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)p);
+    __m256i d = _mm256_sub_epi8(v, _mm256_set1_epi8('0'));
+    __m256i is_digit = _mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8(9)), d);
+    *digits = (uint32_t)_mm256_movemask_epi8(is_digit);
+    *newlines = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+}
+
+// Fast path for the common "[-]digits\n" lines. One vector compare gives
+// digit and newline masks for a whole window, and every line that fits in
+// the window is folded straight from them. Anything unusual (blanks, '+',
+// "\r\n", more than 10 digits, a line crossing the window) stops the
+// fast path and is left to the scalar state machine. Needs 8 bytes of
+// slack after the window for fold_digits(), so it never reads past n.
+static inline __attribute__((always_inline)) size_t
+parse_lines_simd(Parser *ps, const char *buf, size_t i, size_t n, int width,
+                 void (*classify)(const char *, uint64_t *, uint64_t *)) {
+    while (i + width + 8 <= n) {
+        uint64_t digits, newlines;
+        classify(buf + i, &digits, &newlines);
+        uint64_t non_digits = ~digits;
+
+        int off = 0;
+        while (off < width) {
+            int negative = buf[i + off] == '-';
+            int start = off + negative;
+            int len = __builtin_ctzll(non_digits >> start);
+            int end = start + len;
+            if (len == 0 || len > 10 || end >= width || !((newlines >> end) & 1)) {
+                break;
+            }
+            const char *p = buf + i + start;
+            long value = len > 8
+                ? (long)fold_digits(p, len - 8) * 100000000 + (long)fold_digits(p + len - 8, 8)
+                : (long)fold_digits(p, len);
+            ps->sum += (int)(negative ? -value : value);
+            ps->numbers++;
+            off = end + 1;
+        }
+        if (off == 0) {
+            break;
+        }
+        i += off;
+    }
+    return i;
+}
+
+size_t parse_lines_sse2(Parser *ps, const char *buf, size_t i, size_t n) {
+    return parse_lines_simd(ps, buf, i, n, 16, classify_sse2);
+}
+
+__attribute__((target("avx2")))
+size_t parse_lines_avx2(Parser *ps, const char *buf, size_t i, size_t n) {
+    return parse_lines_simd(ps, buf, i, n, 32, classify_avx2);
+}
+#endif
+
+// Picked once in main(): AVX2, SSE2 or none (pure scalar).
+size_t (*parse_lines_fast)(Parser *, const char *, size_t, size_t);
+
+void parse_block(Parser *ps, const char *buf, size_t n) {
+    size_t i = 0;
+    while (i < n) {
+        if (ps->state == LINE_START && parse_lines_fast) {
+            i = parse_lines_fast(ps, buf, i, n);
+        }
+        i = parse_line_scalar(ps, buf, i, n);
+    }
+}
+
+// Block path: large pread()s into the worker's buffer, parsed in place.
+long sum_read(const char *filename, off_t offset, off_t length, char *block, long *numbers) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        perror("Error opening file");
+        exit(1);
+    }
+
+    Parser ps = {0, 0, 0, 0, LINE_START};
+    while (length > 0) {
+        size_t want = length < BLOCK_SIZE ? (size_t)length : BLOCK_SIZE;
+        ssize_t got = pread(fd, block, want, offset);
+        if (got < 0) {
+            perror("Error reading file");
+            exit(1);
+        }
+        if (got == 0) {
+            break;
+        }
+        parse_block(&ps, block, got);
+        offset += got;
+        length -= got;
+    }
+    parser_finish(&ps);
+    close(fd);
+    *numbers += ps.numbers;
+    return ps.sum;
+}
+
+// Zero-copy path: the range is mapped and parsed straight from the page
+// cache. The fast parser never reads past the end of its input, so no
+// padding after the mapping is needed.
+long sum_mmap(const char *filename, off_t offset, off_t length, char *block, long *numbers) {
+    if (length == 0) {
+        return 0;
+    }
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        perror("Error opening file");
+        exit(1);
+    }
+
+    off_t base = offset & ~((off_t)sysconf(_SC_PAGESIZE) - 1);
+    size_t map_len = length + (offset - base);
+    char *map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fd, base);
+    if (map == MAP_FAILED) {
+        // e.g. no address space for the range on a 32-bit build
+        close(fd);
+        return sum_read(filename, offset, length, block, numbers);
+    }
+    madvise(map, map_len, MADV_SEQUENTIAL);
+    madvise(map, map_len, MADV_WILLNEED);
+
+    Parser ps = {0, 0, 0, 0, LINE_START};
+    parse_block(&ps, map + (offset - base), length);
+    parser_finish(&ps);
+
+    munmap(map, map_len);
+    close(fd);
+    *numbers += ps.numbers;
+    return ps.sum;
+}
+
+#ifdef HAVE_IO_URING
+// Raw io_uring, no liburing: the kernel interface is three syscalls and
+// two shared rings. Each worker owns one ring for its whole lifetime.
+typedef struct {
+    int ready;              // 0: not set up yet, 1: usable, -1: setup failed
+    int fd;
+    int fixed;              // the read buffer is registered, use READ_FIXED
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_map, *cq_map;
+    size_t sq_len, cq_len, sqes_len;
+} Ring;
+#endif
+
+// Per-worker I/O state: the read buffer and, for --io=uring, the ring
+// that reads into it.
+typedef struct {
+    char *block;
+#ifdef HAVE_IO_URING
+    Ring ring;
+#endif
+} WorkerIo;
+
+#ifdef HAVE_IO_URING
+int ring_setup(Ring *ring, unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) {
+        return -1;
+    }
+
+    ring->sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sq_map = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->fd, IORING_OFF_SQ_RING);
+    ring->cq_map = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQES);
+    if (ring->sq_map == MAP_FAILED || ring->cq_map == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        close(ring->fd);
+        return -1;
+    }
+
+    char *sq = ring->sq_map, *cq = ring->cq_map;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return 0;
+}
+
+void ring_close(Ring *ring) {
+    if (ring->ready != 1) {
+        return;
+    }
+    munmap(ring->sqes, ring->sqes_len);
+    munmap(ring->cq_map, ring->cq_len);
+    munmap(ring->sq_map, ring->sq_len);
+    close(ring->fd);
+    ring->ready = 0;
+}
+
+// Sets the worker's ring up on first use. The whole read buffer is
+// registered once so the kernel doesn't pin and unpin it on every read;
+// where that is refused (RLIMIT_MEMLOCK on older kernels) plain reads
+// into the same buffer are used.
+int ring_ready(WorkerIo *io) {
+    Ring *ring = &io->ring;
+    if (ring->ready == 0) {
+        ring->ready = ring_setup(ring, URING_DEPTH) == 0 ? 1 : -1;
+        if (ring->ready == 1) {
+            struct iovec iov = {io->block, BLOCK_SIZE};
+            ring->fixed = syscall(__NR_io_uring_register, ring->fd,
+                                  IORING_REGISTER_BUFFERS, &iov, 1) == 0;
+        }
+    }
+    return ring->ready == 1;
+}
+
+void ring_queue_read(Ring *ring, int fd, char *buf, unsigned len, off_t offset, int slot) {
+    unsigned tail = *ring->sq_tail;
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = ring->fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t)buf;
+    sqe->len = len;
+    sqe->off = offset;
+    sqe->buf_index = 0;
+    sqe->user_data = slot;
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+void ring_enter(Ring *ring, unsigned submit, unsigned wait) {
+    unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+    while (syscall(__NR_io_uring_enter, ring->fd, submit, wait, flags, NULL, 0) < 0) {
+        if (errno != EINTR) {
+            perror("Error submitting reads");
+            exit(1);
+        }
+    }
+}
+
+// Asynchronous pipeline: the read buffer is cut into URING_DEPTH slots
+// that are read in parallel and parsed strictly in file order, so the
+// parser works on one slot while the kernel fills the others. A slot is
+// resubmitted for the next chunk as soon as it has been parsed.
+long sum_uring(const char *filename, off_t offset, off_t length, WorkerIo *io, long *numbers) {
+    if (!ring_ready(io)) {
+        return sum_read(filename, offset, length, io->block, numbers);
+    }
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        perror("Error opening file");
+        exit(1);
+    }
+
+    Ring *ring = &io->ring;
+    const unsigned slot_size = BLOCK_SIZE / URING_DEPTH;
+    struct {
+        off_t offset;
+        unsigned len;
+        unsigned filled;
+        int done;
+    } slots[URING_DEPTH];
+    off_t next = offset, end = offset + length;
+    int in_flight = 0, submit = 0;
+
+    for (int s = 0; s < URING_DEPTH && next < end; s++) {
+        slots[s].offset = next;
+        slots[s].len = end - next < slot_size ? (unsigned)(end - next) : slot_size;
+        slots[s].filled = 0;
+        slots[s].done = 0;
+        ring_queue_read(ring, fd, io->block + s * slot_size, slots[s].len, next, s);
+        next += slots[s].len;
+        in_flight++;
+        submit++;
+    }
+
+    Parser ps = {0, 0, 0, 0, LINE_START};
+    int eof = 0;
+    for (int s = 0; in_flight > 0; s = (s + 1) % URING_DEPTH) {
+        while (!slots[s].done) {
+            ring_enter(ring, submit, 1);
+            submit = 0;
+            unsigned head = *ring->cq_head;
+            while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+                struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+                int c = cqe->user_data;
+                if (cqe->res < 0) {
+                    errno = -cqe->res;
+                    perror("Error reading file");
+                    exit(1);
+                }
+                slots[c].filled += cqe->res;
+                if (cqe->res == 0 || slots[c].filled == slots[c].len) {
+                    slots[c].done = 1;
+                } else {
+                    // short read: ask for the rest of the slot
+                    ring_queue_read(ring, fd, io->block + c * slot_size + slots[c].filled,
+                                    slots[c].len - slots[c].filled,
+                                    slots[c].offset + slots[c].filled, c);
+                    submit++;
+                }
+                head++;
+            }
+            __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+        }
+
+        in_flight--;
+        if (!eof) {
+            parse_block(&ps, io->block + s * slot_size, slots[s].filled);
+            // the file ended early: parse nothing after the gap
+            eof = slots[s].filled < slots[s].len;
+        }
+        if (!eof && next < end) {
+            slots[s].offset = next;
+            slots[s].len = end - next < slot_size ? (unsigned)(end - next) : slot_size;
+            slots[s].filled = 0;
+            slots[s].done = 0;
+            ring_queue_read(ring, fd, io->block + s * slot_size, slots[s].len, next, s);
+            next += slots[s].len;
+            in_flight++;
+            submit++;
+        }
+    }
+    parser_finish(&ps);
+    close(fd);
+    *numbers += ps.numbers;
+    return ps.sum;
+}
+#endif
+
+double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+void sum(const FileInfo *file, const Task *task, WorkerIo *io, long *result, WorkerStats *stats) {
+    double start = now_ms();
+    if (options.io == IO_STDIO) {
+        *result = sum_stdio(file->filename, task->offset, task->length, &stats->numbers);
+    } else if (options.io == IO_MMAP) {
+        *result = sum_mmap(file->filename, task->offset, task->length, io->block, &stats->numbers);
+#ifdef HAVE_IO_URING
+    } else if (options.io == IO_URING) {
+        *result = sum_uring(file->filename, task->offset, task->length, io, &stats->numbers);
+#endif
+    } else {
+        *result = sum_read(file->filename, task->offset, task->length, io->block, &stats->numbers);
+    }
+    stats->busy_ms += now_ms() - start;
+    stats->tasks++;
+    stats->bytes += task->length;
+}
+
+// First line start at or after pos: pos itself if the byte before it is
+// '\n', otherwise the position right after the next '\n' (or the end of
+// the file). Only the coordinator calls this, a few times per giant file.
+off_t next_line_start(int fd, off_t pos, off_t size) {
+    char window[4096];
+    if (pos <= 0 || pos >= size) {
+        return pos <= 0 ? 0 : size;
+    }
+    off_t at = pos - 1;
+    while (at < size) {
+        ssize_t got = pread(fd, window, sizeof(window), at);
+        if (got <= 0) {
+            break;
+        }
+        char *nl = memchr(window, '\n', got);
+        if (nl) {
+            return at + (nl - window) + 1;
+        }
+        at += got;
+    }
+    return size;
+}
+
+// Cuts every file into tasks. With splitting off each file is one task;
+// otherwise files bigger than the range size are cut into about equal
+// ranges, each end snapped forward to a line start, so a line (and the
+// number on it) always belongs to exactly one range. Returns the task count.
+int make_tasks(FileInfo files[], int file_count, int parallelism, Task **tasks_out) {
+    off_t range = options.split;
+    if (range < 0) {
+        off_t total = 0;
+        for (int i = 0; i < file_count; i++) {
+            total += files[i].size;
+        }
+        range = total / (4 * parallelism);
+    }
+    if (range > 0 && range < MIN_SPLIT_SIZE) {
+        range = MIN_SPLIT_SIZE;
+    }
+
+    int cap = file_count;
+    if (range > 0) {
+        for (int i = 0; i < file_count; i++) {
+            cap += files[i].size / range;
+        }
+    }
+    Task *tasks = malloc((cap > 0 ? cap : 1) * sizeof(Task));
+    if (!tasks) {
+        perror("Error allocating tasks");
+        exit(1);
+    }
+
+    int count = 0;
+    for (int i = 0; i < file_count; i++) {
+        off_t size = files[i].size;
+        if (range == 0 || size <= range) {
+            tasks[count++] = (Task){i, 0, size};
+            continue;
+        }
+
+        int fd = open(files[i].filename, O_RDONLY);
+        if (fd < 0) {
+            perror("Error opening file");
+            exit(1);
+        }
+        off_t parts = (size + range - 1) / range;
+        off_t start = 0;
+        for (off_t k = 1; k <= parts && start < size; k++) {
+            off_t end = k == parts ? size : next_line_start(fd, size / parts * k, size);
+            if (end > start) {
+                tasks[count++] = (Task){i, start, end - start};
+                start = end;
+            }
+        }
+        close(fd);
+    }
+
+    *tasks_out = tasks;
+    return count;
+}
+
+// Old boustrophedon split: file i goes to worker i % parallelism,
+// every second row is walked backwards.
+int static_owner(int i, int parallelism) {
+    int a = i / parallelism;
+    int b = i % parallelism;
+    return a % 2 == 0 ? b : parallelism - 1 - b;
+}
+
+// Owner side: the most recently filled end, i.e. the largest task left.
+int deque_pop(Deque *d, const int *items, int *task) {
+    long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&d->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long t = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+    if (t > b) {
+        __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    *task = items[d->base + b];
+    if (t < b) {
+        return 1;
+    }
+    // the last task: race the thieves for it
+    int won = __atomic_compare_exchange_n(&d->top, &t, t + 1, 0,
+                                          __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+    __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+    return won;
+}
+
+// Thief side: the smallest task left. Returns 1 on success, 0 if the
+// deque is empty and -1 if another worker got there first.
+int deque_steal(Deque *d, const int *items, int *task) {
+    long t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+    if (t >= b) {
+        return 0;
+    }
+    *task = items[d->base + t];
+    if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, 0,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return -1;
+    }
+    return 1;
+}
+
+// Initial split for --sched=steal: greedy LPT by bytes over the tasks,
+// which main() sorted by length. Each slice is filled from the bottom so
+// the owner starts with its largest task and thieves take the smallest.
+void fill_deques(WorkQueue *queue, Task tasks[], int n, int parallelism) {
+    off_t load[MAX_PARALLELISM] = {0};
+    int count[MAX_PARALLELISM] = {0};
+    int *owner = malloc(sizeof(int) * (n ? n : 1));
+    if (!owner) {
+        perror("Error allocating deques");
+        exit(1);
+    }
+    for (int i = 0; i < n; i++) {
+        int best = 0;
+        for (int p = 1; p < parallelism; p++) {
+            if (load[p] < load[best]) {
+                best = p;
+            }
+        }
+        owner[i] = best;
+        load[best] += tasks[i].length;
+        count[best]++;
+    }
+
+    int base = 0;
+    for (int p = 0; p < parallelism; p++) {
+        Deque *d = &queue->deques[p];
+        d->base = base;
+        d->top = 0;
+        d->bottom = count[p];
+        base += count[p];
+    }
     for (int i = 0; i < n; i++) {
-        int a = i / parallelism;
-        int b = i % parallelism;
-        if ((a % 2 == 0 && b == p) || (a % 2 == 1 && b == parallelism - 1 - p)) {
-            if ((i+1) % parallelism == 0) incr = 1 - incr;
+        Deque *d = &queue->deques[owner[i]];
+        queue->items[d->base + --count[owner[i]]] = i;
+    }
+    free(owner);
+}
 
-            long file_sum = 0;
-            sum(files[i].filename, &file_sum);
-            total_sum += file_sum;
+long process(FileInfo files[], Task tasks[], int n, int p, int parallelism,
+             WorkQueue *queue, WorkerIo *io, WorkerStats *stats) {
+    long total_sum = 0;
+    if (options.sched == SCHED_STEAL) {
+        int i;
+        while (deque_pop(&queue->deques[p], queue->items, &i)) {
+            long task_sum = 0;
+            sum(&files[tasks[i].file], &tasks[i], io, &task_sum, stats);
+            total_sum += task_sum;
+        }
+        // own deque is drained for good; walk the others until all are
+        for (int k = 1; k < parallelism;) {
+            Deque *victim = &queue->deques[(p + k) % parallelism];
+            int got = deque_steal(victim, queue->items, &i);
+            if (got < 0) {
+                continue;
+            }
+            if (got == 0) {
+                k++;
+                continue;
+            }
+            long task_sum = 0;
+            sum(&files[tasks[i].file], &tasks[i], io, &task_sum, stats);
+            total_sum += task_sum;
+            stats->steals++;
+            k = 1;
+        }
+    } else if (options.sched == SCHED_STATIC) {
+        for (int i = 0; i < n; i++) {
+            if (static_owner(i, parallelism) != p) {
+                continue;
+            }
+            long task_sum = 0;
+            sum(&files[tasks[i].file], &tasks[i], io, &task_sum, stats);
+            total_sum += task_sum;
+        }
+    } else {
+        int i;
+        while ((i = __atomic_fetch_add(&queue->next, 1, __ATOMIC_RELAXED)) < n) {
+            long task_sum = 0;
+            sum(&files[tasks[i].file], &tasks[i], io, &task_sum, stats);
+            total_sum += task_sum;
         }
     }
-    write(pipe_fd, &total_sum, sizeof(total_sum));
-    close(pipe_fd);
-    exit(0);
+    return total_sum;
 }
 
-int main(int argc, char *argv[]) {
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s <input_file> <parallelism>\n", argv[0]);
+// --stream: the coordinator publishes names from the list while the
+// workers are already running. Workers stat() the names in parallel and
+// push them into a size-ordered heap; summing always takes the biggest
+// file known so far, which approximates LPT without waiting for the
+// whole list. The heap is guarded by a spinlock, the rest are plain
+// atomic counters.
+#define STAT_BATCH 16
+
+typedef struct {
+    char name[MAX_FILENAME_LEN];
+    off_t size;
+} StreamEntry;
+
+typedef struct {
+    int published;      // names [0, published) are filled in
+    int done;           // the coordinator reached the end of the list
+    int claimed;        // names handed out to be stat()ed
+    int sized;          // names stat()ed and pushed into the heap
+    int lock;
+    int heap_len;
+    int heap[MAX_FILES];
+    StreamEntry entries[MAX_FILES];
+} FileStream;
+
+void stream_lock(FileStream *s) {
+    while (__atomic_exchange_n(&s->lock, 1, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&s->lock, __ATOMIC_RELAXED)) {
+            sched_yield();
+        }
+    }
+}
+
+void stream_unlock(FileStream *s) {
+    __atomic_store_n(&s->lock, 0, __ATOMIC_RELEASE);
+}
+
+// Next published name to stat, or -1 if none is available right now.
+int stream_claim(FileStream *s) {
+    int c = __atomic_load_n(&s->claimed, __ATOMIC_ACQUIRE);
+    while (c < __atomic_load_n(&s->published, __ATOMIC_ACQUIRE)) {
+        if (__atomic_compare_exchange_n(&s->claimed, &c, c + 1, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            return c;
+        }
+    }
+    return -1;
+}
+
+void stream_push(FileStream *s, int idx) {
+    stream_lock(s);
+    int i = s->heap_len++;
+    while (i > 0 && s->entries[s->heap[(i - 1) / 2]].size < s->entries[idx].size) {
+        s->heap[i] = s->heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    s->heap[i] = idx;
+    __atomic_fetch_add(&s->sized, 1, __ATOMIC_RELEASE);
+    stream_unlock(s);
+}
+
+// Biggest sized file not yet summed, or -1.
+int stream_pop(FileStream *s) {
+    stream_lock(s);
+    if (s->heap_len == 0) {
+        stream_unlock(s);
+        return -1;
+    }
+    int top = s->heap[0];
+    int last = s->heap[--s->heap_len];
+    int i = 0;
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= s->heap_len) {
+            break;
+        }
+        if (child + 1 < s->heap_len &&
+            s->entries[s->heap[child + 1]].size > s->entries[s->heap[child]].size) {
+            child++;
+        }
+        if (s->entries[s->heap[child]].size <= s->entries[last].size) {
+            break;
+        }
+        s->heap[i] = s->heap[child];
+        i = child;
+    }
+    s->heap[i] = last;
+    stream_unlock(s);
+    return top;
+}
+
+long process_stream(FileStream *s, WorkerIo *io, WorkerStats *stats) {
+    long total_sum = 0;
+    for (;;) {
+        int statted = 0, idx;
+        while (statted < STAT_BATCH && (idx = stream_claim(s)) >= 0) {
+            struct stat st;
+            if (stat(s->entries[idx].name, &st) != 0) {
+                perror("Error getting file size");
+                exit(1);
+            }
+            s->entries[idx].size = st.st_size;
+            stream_push(s, idx);
+            statted++;
+        }
+
+        if ((idx = stream_pop(s)) >= 0) {
+            FileInfo file = {s->entries[idx].name, s->entries[idx].size};
+            Task task = {idx, 0, file.size};
+            long task_sum = 0;
+            sum(&file, &task, io, &task_sum, stats);
+            total_sum += task_sum;
+            continue;
+        }
+        if (statted) {
+            continue;
+        }
+        // Every name is sized and the heap is empty: whoever pushed the
+        // last entries popped them right after, so nothing is left behind.
+        if (__atomic_load_n(&s->done, __ATOMIC_ACQUIRE) &&
+            __atomic_load_n(&s->sized, __ATOMIC_ACQUIRE) ==
+            __atomic_load_n(&s->published, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        sched_yield();
+    }
+    return total_sum;
+}
+
+void *map_shared(size_t size, const char *what) {
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        perror(what);
+        exit(1);
+    }
+    return p;
+}
+
+typedef struct Run Run;
+
+typedef struct {
+    Run *run;
+    int p;
+    WorkerIo io;
+} WorkerArgs;
+
+// Everything one parallel pass needs. Workers get either a ready task
+// list (files/tasks/queue) or, with --stream, the FileStream.
+struct Run {
+    FileInfo *files;
+    Task *tasks;
+    int task_count;
+    FileStream *stream;
+    int parallelism;
+    WorkQueue *queue;
+    WorkerSlot *slots;
+    pid_t pids[MAX_PARALLELISM];
+    int pipe_fds[MAX_PARALLELISM][2];
+    WorkerArgs args[MAX_PARALLELISM];
+    char *arena;
+    double spawn_ms;
+};
+
+long worker_main(Run *r, int p, WorkerIo *io, WorkerStats *stats) {
+    double start = now_ms();
+    long total_sum;
+    r->slots[p].started_ms = start;
+    if (r->stream) {
+        total_sum = process_stream(r->stream, io, stats);
+    } else {
+        total_sum = process(r->files, r->tasks, r->task_count, p, r->parallelism, r->queue,
+                            io, stats);
+    }
+#ifdef HAVE_IO_URING
+    // clone workers share the fd table and address space with the coordinator
+    ring_close(&io->ring);
+#endif
+    stats->total_ms = now_ms() - start;
+    return total_sum;
+}
+
+#ifdef HAVE_CLONE
+// Body of a clone()d worker. It shares the coordinator's memory, so it
+// must not touch malloc or stdio: glibc only locks those once pthreads
+// are in use. The read and mmap engines only make plain syscalls.
+// Returning (not exit()) ends just this worker.
+int clone_worker(void *arg) {
+    WorkerArgs *a = arg;
+    WorkerSlot *slot = &a->run->slots[a->p];
+    slot->sum = worker_main(a->run, a->p, &a->io, &slot->stats);
+    return 0;
+}
+
+// Workers as clone(CLONE_VM | CLONE_FILES | ...) children: no page tables
+// to copy and no pipes; each gets its own stack and read buffer up front.
+void start_clone_workers(Run *r) {
+    size_t per_worker = WORKER_STACK_SIZE + BLOCK_SIZE;
+    r->arena = mmap(NULL, per_worker * r->parallelism, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (r->arena == MAP_FAILED) {
+        perror("Error allocating worker stacks");
         exit(1);
     }
 
+    for (int i = 0; i < r->parallelism; i++) {
+        char *stack = r->arena + per_worker * i;
+        r->args[i] = (WorkerArgs){r, i, {.block = stack + WORKER_STACK_SIZE}};
+        r->pids[i] = clone(clone_worker, stack + WORKER_STACK_SIZE,
+                           CLONE_VM | CLONE_FS | CLONE_FILES | CLONE_SIGHAND | SIGCHLD,
+                           &r->args[i]);
+        if (r->pids[i] < 0) {
+            perror("Error creating worker");
+            exit(1);
+        }
+    }
+}
+#endif
+
+void start_workers(Run *r) {
+    r->queue = map_shared(sizeof(WorkQueue), "Error creating work queue");
+    r->slots = map_shared(sizeof(WorkerSlot) * r->parallelism, "Error creating result slots");
+    r->queue->next = 0;
+    if (options.sched == SCHED_STEAL && r->task_count > 0) {
+        r->queue->items = map_shared(sizeof(int) * r->task_count, "Error creating deques");
+        fill_deques(r->queue, r->tasks, r->task_count, r->parallelism);
+    }
+
+    // children inherit unflushed stdio buffers and would print them again
+    fflush(stdout);
+    r->spawn_ms = now_ms();
+
+#ifdef HAVE_CLONE
+    if (options.backend == BACKEND_CLONE) {
+        start_clone_workers(r);
+        return;
+    }
+#endif
+    for (int i = 0; i < r->parallelism; i++) {
+        pipe(r->pipe_fds[i]);
+        if ((r->pids[i] = fork()) == 0) {
+            close(r->pipe_fds[i][0]);
+            WorkerIo io = {.block = malloc(BLOCK_SIZE)};
+            if (!io.block) {
+                perror("Error allocating read buffer");
+                exit(1);
+            }
+            WorkerStats stats = {0};
+            long process_sum = worker_main(r, i, &io, &stats);
+            write(r->pipe_fds[i][1], &process_sum, sizeof(process_sum));
+            write(r->pipe_fds[i][1], &stats, sizeof(stats));
+            close(r->pipe_fds[i][1]);
+            exit(0);
+        } else {
+            close(r->pipe_fds[i][1]);
+        }
+    }
+}
+
+// --stats: a line per worker and the imbalance of the whole pass, i.e.
+// the busiest worker against the average one (1.00 is perfect).
+void print_stats(Run *r) {
+    double busy_max = 0, busy_avg = 0;
+    fprintf(stderr, "%6s %7s %7s %12s %11s %10s %10s %9s\n",
+            "worker", "tasks", "steals", "bytes", "numbers", "busy_ms", "idle_ms", "MB/s");
+    for (int i = 0; i < r->parallelism; i++) {
+        WorkerStats *st = &r->slots[i].stats;
+        double idle = st->total_ms > st->busy_ms ? st->total_ms - st->busy_ms : 0;
+        fprintf(stderr, "%6d %7ld %7ld %12ld %11ld %10.1f %10.1f %9.1f\n",
+                i, st->tasks, st->steals, st->bytes, st->numbers, st->busy_ms, idle,
+                st->busy_ms > 0 ? st->bytes / (1024.0 * 1024.0) * 1000 / st->busy_ms : 0);
+        busy_avg += st->busy_ms / r->parallelism;
+        busy_max = st->busy_ms > busy_max ? st->busy_ms : busy_max;
+    }
+    fprintf(stderr, "imbalance: %.2f (max busy %.1f ms, mean %.1f ms)\n",
+            busy_avg > 0 ? busy_max / busy_avg : 1.0, busy_max, busy_avg);
+}
+
+// Fork workers report their sums through the pipes; clone workers have
+// written them straight into their slot by the time waitpid() returns.
+long finish_workers(Run *r) {
+    long total_sum = 0;
+    for (int i = 0; i < r->parallelism; i++) {
+        long process_sum;
+        if (options.backend == BACKEND_CLONE) {
+            waitpid(r->pids[i], NULL, 0);
+            process_sum = r->slots[i].sum;
+        } else {
+            read(r->pipe_fds[i][0], &process_sum, sizeof(process_sum));
+            read(r->pipe_fds[i][0], &r->slots[i].stats, sizeof(WorkerStats));
+            close(r->pipe_fds[i][0]);
+            waitpid(r->pids[i], NULL, 0);
+        }
+        total_sum += process_sum;
+    }
+
+    if (options.timing) {
+        double total_ms = now_ms() - r->spawn_ms, startup_max = 0, startup_avg = 0;
+        for (int i = 0; i < r->parallelism; i++) {
+            double startup = r->slots[i].started_ms - r->spawn_ms;
+            startup_avg += startup / r->parallelism;
+            startup_max = startup > startup_max ? startup : startup_max;
+        }
+        fprintf(stderr, "%s p=%d startup avg %.1f us max %.1f us total %.1f ms\n",
+                options.backend == BACKEND_CLONE ? "clone" : "fork", r->parallelism,
+                startup_avg * 1000, startup_max * 1000, total_ms);
+    }
+    if (options.stats) {
+        print_stats(r);
+    }
+
+#ifdef HAVE_CLONE
+    if (options.backend == BACKEND_CLONE) {
+        munmap(r->arena, (WORKER_STACK_SIZE + BLOCK_SIZE) * r->parallelism);
+    }
+#endif
+    munmap(r->slots, sizeof(WorkerSlot) * r->parallelism);
+    if (r->queue->items) {
+        munmap(r->queue->items, sizeof(int) * r->task_count);
+    }
+    munmap(r->queue, sizeof(WorkQueue));
+    return total_sum;
+}
+
+// One full parallel pass over a ready task list.
+long run(FileInfo files[], Task tasks[], int task_count, int parallelism) {
+    Run r = {.files = files, .tasks = tasks, .task_count = task_count,
+             .parallelism = parallelism};
+    start_workers(&r);
+    return finish_workers(&r);
+}
+
+// One pass with the listing overlapped: workers start first, then the
+// coordinator reads the list and publishes names one by one.
+long run_stream(FILE *input_file, int parallelism) {
+    FileStream *stream = map_shared(sizeof(FileStream), "Error creating file stream");
+    Run r = {.stream = stream, .parallelism = parallelism};
+    start_workers(&r);
+
+    char buffer[MAX_FILENAME_LEN];
+    int count = 0;
+    while (fgets(buffer, MAX_FILENAME_LEN, input_file) && count < MAX_FILES) {
+        buffer[strcspn(buffer, "\n")] = '\0';
+        memcpy(stream->entries[count].name, buffer, sizeof(buffer));
+        __atomic_store_n(&stream->published, ++count, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&stream->done, 1, __ATOMIC_RELEASE);
+
+    long total_sum = finish_workers(&r);
+    munmap(stream, sizeof(FileStream));
+    return total_sum;
+}
+
+// Asks the kernel to drop the files' clean pages from the page cache.
+// Works without root, unlike /proc/sys/vm/drop_caches, but pages mapped
+// or dirtied by someone else stay, so "cold" is best effort.
+void drop_page_cache(FileInfo files[], int file_count) {
+    for (int i = 0; i < file_count; i++) {
+        int fd = open(files[i].filename, O_RDONLY);
+        if (fd < 0) {
+            continue;
+        }
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+// --bench: every engine once on a cold and once on a warm page cache.
+void bench(FileInfo files[], int file_count, Task tasks[], int task_count, int parallelism) {
+    static const struct {
+        IoEngine io;
+        const char *name;
+    } engines[] = {
+        {IO_STDIO, "stdio"},
+        {IO_READ, "read"},
+        {IO_MMAP, "mmap"},
+#ifdef HAVE_IO_URING
+        {IO_URING, "uring"},
+#endif
+    };
+
+    double megabytes = 0;
+    for (int i = 0; i < task_count; i++) {
+        megabytes += tasks[i].length / (1024.0 * 1024.0);
+    }
+
+    IoEngine saved = options.io;
+    long expected = 0;
+    int have_expected = 0;
+    printf("%-6s %-5s %10s %10s\n", "engine", "cache", "ms", "MB/s");
+    for (size_t e = 0; e < sizeof(engines) / sizeof(engines[0]); e++) {
+        if (engines[e].io == IO_STDIO && options.backend == BACKEND_CLONE) {
+            continue;
+        }
+        options.io = engines[e].io;
+        for (int warm = 0; warm <= 1; warm++) {
+            if (!warm) {
+                drop_page_cache(files, file_count);
+            }
+            double start = now_ms();
+            long total = run(files, tasks, task_count, parallelism);
+            double ms = now_ms() - start;
+            if (!have_expected) {
+                expected = total;
+                have_expected = 1;
+            } else if (total != expected) {
+                fprintf(stderr, "%s: sum %ld differs from %ld\n", engines[e].name, total, expected);
+            }
+            printf("%-6s %-5s %10.1f %10.1f\n", engines[e].name, warm ? "warm" : "cold",
+                   ms, ms > 0 ? megabytes * 1000 / ms : 0);
+        }
+    }
+    printf("sum: %ld\n", expected);
+    options.io = saved;
+}
+
+void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s <input_file> <parallelism> [--sched=queue|static|steal]"
+                    " [--backend=fork|clone] [--io=read|mmap|uring|stdio] [--scalar]"
+                    " [--split[=BYTES]] [--stream] [--bench] [--timing] [--stats]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        usage(argv[0]);
+    }
+
     char *input_filename = argv[1];
     int parallelism = atoi(argv[2]);
 
-    if (parallelism < 1 || parallelism > 20) {
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "--sched=queue") == 0) {
+            options.sched = SCHED_QUEUE;
+        } else if (strcmp(argv[i], "--sched=static") == 0) {
+            options.sched = SCHED_STATIC;
+        } else if (strcmp(argv[i], "--sched=steal") == 0) {
+            options.sched = SCHED_STEAL;
+        } else if (strcmp(argv[i], "--io=read") == 0) {
+            options.io = IO_READ;
+        } else if (strcmp(argv[i], "--io=stdio") == 0) {
+            options.io = IO_STDIO;
+        } else if (strcmp(argv[i], "--io=mmap") == 0) {
+            options.io = IO_MMAP;
+#ifdef HAVE_IO_URING
+        } else if (strcmp(argv[i], "--io=uring") == 0) {
+            options.io = IO_URING;
+#endif
+        } else if (strcmp(argv[i], "--bench") == 0) {
+            options.bench = 1;
+        } else if (strcmp(argv[i], "--timing") == 0) {
+            options.timing = 1;
+        } else if (strcmp(argv[i], "--stream") == 0) {
+            options.stream = 1;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            options.stats = 1;
+        } else if (strcmp(argv[i], "--backend=fork") == 0) {
+            options.backend = BACKEND_FORK;
+#ifdef HAVE_CLONE
+        } else if (strcmp(argv[i], "--backend=clone") == 0) {
+            options.backend = BACKEND_CLONE;
+#endif
+        } else if (strcmp(argv[i], "--scalar") == 0) {
+            options.scalar = 1;
+        } else if (strcmp(argv[i], "--split") == 0) {
+            options.split = -1;
+        } else if (strncmp(argv[i], "--split=", 8) == 0) {
+            options.split = atoll(argv[i] + 8);
+            if (options.split <= 0) {
+                usage(argv[0]);
+            }
+        } else {
+            usage(argv[0]);
+        }
+    }
+
+    if (parallelism < 1 || parallelism > MAX_PARALLELISM) {
         fprintf(stderr, "Parallelism degree must be in [1, 20]\n");
         exit(1);
     }
 
+    if (options.backend == BACKEND_CLONE && options.io == IO_STDIO) {
+        fprintf(stderr, "The stdio engine is not safe in clone workers\n");
+        exit(1);
+    }
+
+    // the streamed list is never complete up front, so nothing that needs
+    // all sizes (splitting, the static split, repeated bench passes) fits
+    if (options.stream && (options.split || options.sched != SCHED_QUEUE || options.bench)) {
+        fprintf(stderr, "--stream can't be combined with --split, --sched=static|steal or --bench\n");
+        exit(1);
+    }
+
+#ifdef HAVE_X86_SIMD
+    if (!options.scalar) {
+        __builtin_cpu_init();
+        parse_lines_fast = __builtin_cpu_supports("avx2") ? parse_lines_avx2 : parse_lines_sse2;
+    }
+#endif
+
     FILE *input_file = fopen(input_filename, "r");
     if (!input_file) {
         fprintf(stderr, "Error opening input file");
         exit(1);
     }
 
+    if (options.stream) {
+        printf("sum: %ld\n", run_stream(input_file, parallelism));
+        fclose(input_file);
+        return 0;
+    }
+
     FileInfo files[MAX_FILES];
     int file_count = 0;
     char buffer[MAX_FILENAME_LEN];
@@ -94,40 +1370,21 @@ int main(int argc, char *argv[]) {
     }
     fclose(input_file);
 
-    qsort(files, file_count, sizeof(FileInfo), compare);
-
-    int pipe_fds[parallelism][2];
-    pid_t pids[parallelism];
-
-    int files_per_process = file_count / parallelism;
-    int remaining_files = file_count % parallelism;
+    Task *tasks;
+    int task_count = make_tasks(files, file_count, parallelism, &tasks);
+    qsort(tasks, task_count, sizeof(Task),
+          options.sched == SCHED_STATIC ? compare_ascending : compare);
 
-    for (int i = 0; i < parallelism; i++) {
-        pipe(pipe_fds[i]);
-        if ((pids[i] = fork()) == 0) {
-            close(pipe_fds[i][0]);
-            int start = i * files_per_process + (i < remaining_files ? i : remaining_files);
-            int end = start + files_per_process + (i < remaining_files ? 1 : 0);
-            process(files, file_count, i, parallelism, pipe_fds[i][1]);
-        } else {
-            close(pipe_fds[i][1]);
-        }
+    if (options.bench) {
+        bench(files, file_count, tasks, task_count, parallelism);
+    } else {
+        printf("sum: %ld\n", run(files, tasks, task_count, parallelism));
     }
 
-    long total_sum = 0;
-    for (int i = 0; i < parallelism; i++) {
-        long process_sum;
-        read(pipe_fds[i][0], &process_sum, sizeof(process_sum));
-        total_sum += process_sum;
-        close(pipe_fds[i][0]);
-        waitpid(pids[i], NULL, 0);
-    }
-
-    printf("sum: %ld\n", total_sum);
-
+    free(tasks);
     for (int i = 0; i < file_count; i++) {
         free(files[i].filename);
     }
 
     return 0;
-}
\ No newline at end of file
+}
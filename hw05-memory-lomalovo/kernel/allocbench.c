@@ -0,0 +1,211 @@
+// Allocator microbenchmarks behind allocbench(): a pattern of
+// allocations and frees timed with r_time(). Every block is tagged
+// while it is held and checked before it is freed, so a run doubles as
+// a self-test of the allocator.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "allocbench.h"
+
+#define BENCH_TAG 0x5bd1e995a5a5a5a5UL
+#define RING_SIZE 256
+#define IDLE_TIMEOUT 10000000   // r_time() ticks, a second on qemu
+
+// Blocks on their way from producers to consumers; tail - head of them.
+// Each remembers its allocator, for runs that overlap.
+struct {
+    struct spinlock lock;
+    int users;      // producer and consumer runs going on
+    int head;
+    int tail;
+    struct {
+        void* p;
+        int allocator;
+    } blocks[RING_SIZE];
+} ring;
+
+void allocbench_init() {
+    initlock(&ring.lock, "bench_ring");
+    ring.users = 0;
+    ring.head = 0;
+    ring.tail = 0;
+}
+
+void* bench_alloc(struct allocbench* b, int order) {
+    void* p;
+    if (b->allocator == BENCH_KALLOC) {
+        p = kalloc();
+    } else if (b->allocator == BENCH_SLAB) {
+        p = slab_alloc(KOBJ_PIPE);
+    } else {
+        p = buddy_alloc(1 << order);
+    }
+    if (p == 0) {
+        b->failed++;
+        return 0;
+    }
+    *(uint64*)p = (uint64)p ^ BENCH_TAG;
+    b->allocs++;
+    return p;
+}
+
+void bench_free(struct allocbench* b, void* p, int allocator) {
+    if (*(uint64*)p != ((uint64)p ^ BENCH_TAG)) {
+        b->corrupt++;
+    }
+    if (allocator == BENCH_KALLOC) {
+        kfree(p);
+    } else if (allocator == BENCH_SLAB) {
+        slab_free(p);
+    } else {
+        buddy_free(p);
+    }
+    b->frees++;
+}
+
+uint64 bench_rand(uint64* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+// Takes the oldest block off the ring; 0 if it is empty.
+void* ring_get(int* allocator) {
+    void* p = 0;
+    acquire(&ring.lock);
+    if (ring.head < ring.tail) {
+        p = ring.blocks[ring.head % RING_SIZE].p;
+        *allocator = ring.blocks[ring.head % RING_SIZE].allocator;
+        ring.head++;
+    }
+    release(&ring.lock);
+    return p;
+}
+
+// Adds p to the ring; 0 if it is full.
+int ring_put(void* p, int allocator) {
+    int ok = 0;
+    acquire(&ring.lock);
+    if (ring.tail - ring.head < RING_SIZE) {
+        ring.blocks[ring.tail % RING_SIZE].p = p;
+        ring.blocks[ring.tail % RING_SIZE].allocator = allocator;
+        ring.tail++;
+        ok = 1;
+    }
+    release(&ring.lock);
+    return ok;
+}
+
+void ring_join() {
+    acquire(&ring.lock);
+    ring.users++;
+    release(&ring.lock);
+}
+
+// The last producer or consumer run to end frees what is left on the
+// ring: blocks put there after the consumers gave up would never be
+// freed otherwise.
+void ring_leave(struct allocbench* b) {
+    acquire(&ring.lock);
+    int last = --ring.users == 0;
+    release(&ring.lock);
+    if (last) {
+        int allocator;
+        void* p;
+        while ((p = ring_get(&allocator)) != 0) {
+            bench_free(b, p, allocator);
+        }
+    }
+}
+
+// Runs the benchmark b describes and fills in its results.
+// Returns -1 if the parameters make no sense.
+int allocbench(struct allocbench* b) {
+    if (b->pattern < BENCH_LIFO || b->pattern > BENCH_CONSUMER ||
+        b->allocator < BENCH_BUDDY || b->allocator > BENCH_SLAB ||
+        b->order < 0 || b->order > 9 || b->batch < 1 || b->batch > BENCH_MAXBATCH || b->ops < 1) {
+        return -1;
+    }
+    void** held = kalloc();
+    if (held == 0) {
+        return -1;
+    }
+    b->allocs = 0;
+    b->frees = 0;
+    b->failed = 0;
+    b->corrupt = 0;
+    uint64 seed = r_time() | 1;
+
+    uint64 start = r_time(), stop;
+    if (b->pattern == BENCH_LIFO || b->pattern == BENCH_FIFO) {
+        while (b->allocs + b->failed < b->ops) {
+            int n = 0;
+            while (n < b->batch && b->allocs + b->failed < b->ops) {
+                void* p = bench_alloc(b, b->order);
+                if (p) {
+                    held[n++] = p;
+                }
+            }
+            for (int i = 0; i < n; i++) {
+                bench_free(b, held[b->pattern == BENCH_LIFO ? n - 1 - i : i], b->allocator);
+            }
+        }
+        stop = r_time();
+    } else if (b->pattern == BENCH_RANDOM) {
+        for (int i = 0; i < b->batch; i++) {
+            held[i] = 0;
+        }
+        while (b->allocs + b->failed < b->ops) {
+            int i = bench_rand(&seed) % b->batch;
+            if (held[i]) {
+                bench_free(b, held[i], b->allocator);
+                held[i] = 0;
+            } else {
+                held[i] = bench_alloc(b, bench_rand(&seed) % (b->order + 1));
+            }
+        }
+        for (int i = 0; i < b->batch; i++) {
+            if (held[i]) {
+                bench_free(b, held[i], b->allocator);
+            }
+        }
+        stop = r_time();
+    } else if (b->pattern == BENCH_PRODUCER) {
+        ring_join();
+        while (b->allocs + b->failed < b->ops) {
+            void* p = bench_alloc(b, b->order);
+            if (p && !ring_put(p, b->allocator)) {
+                // the consumers are behind
+                bench_free(b, p, b->allocator);
+            }
+        }
+        stop = r_time();
+        ring_leave(b);
+    } else {
+        ring_join();
+        // runs until it has freed ops blocks or seen no producer for a
+        // while; the time spent waiting for the first block counts
+        stop = start;
+        uint64 idle = r_time();
+        while (b->frees < b->ops) {
+            int allocator;
+            void* p = ring_get(&allocator);
+            if (p) {
+                bench_free(b, p, allocator);
+                idle = stop = r_time();
+            } else if (r_time() - idle > IDLE_TIMEOUT) {
+                break;
+            }
+        }
+        ring_leave(b);
+    }
+
+    b->time = stop - start;
+    kfree(held);
+    return 0;
+}
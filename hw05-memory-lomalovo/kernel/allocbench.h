@@ -0,0 +1,30 @@
+// Allocator microbenchmark, run in the kernel by allocbench().
+
+// patterns
+#define BENCH_LIFO      0   // allocate a batch, free it newest first
+#define BENCH_FIFO      1   // allocate a batch, free it oldest first
+#define BENCH_RANDOM    2   // random allocs and frees, orders 0..order
+#define BENCH_PRODUCER  3   // allocate, hand over to a consumer
+#define BENCH_CONSUMER  4   // free what producers handed over
+
+// allocators
+#define BENCH_BUDDY     0   // buddy_alloc(2^order)
+#define BENCH_KALLOC    1   // kalloc(), one page
+#define BENCH_SLAB      2   // slab_alloc(), a struct pipe
+
+#define BENCH_MAXBATCH  512
+
+struct allocbench {
+  // set by the caller
+  int pattern;
+  int allocator;
+  int order;        // block size for BENCH_BUDDY, 2^order pages
+  int batch;        // blocks held at once, at most BENCH_MAXBATCH
+  int ops;          // allocations to do; frees for BENCH_CONSUMER
+  // results
+  uint64 time;      // r_time() ticks the run took
+  int allocs;
+  int frees;
+  int failed;       // allocations that returned 0
+  int corrupt;      // blocks that changed while they were held
+};
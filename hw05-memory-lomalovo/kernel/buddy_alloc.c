@@ -9,49 +9,190 @@
 #include "riscv.h"
 #include "defs.h"
 #include "proc.h"
+#include "memstat.h"
 
-#define PAGES 512 * 32
-#define NODES (2 * PAGES - 1)
+// Pages are numbered from KERNBASE, so that a block of level lvl is
+// aligned to 2^lvl pages in physical memory too. The kernel image below
+// end simply never becomes free.
+#define PAGES ((PHYSTOP - KERNBASE) / PGSIZE)
 #define DEPTH 15
 
+#if DEPTH != MEMSTAT_ORDERS
+#error "struct buddy_stats must have a free_by_size entry per level"
+#endif
+
+// Per-CPU magazines: blocks of the smallest MAG_LEVELS sizes are cached
+// per CPU and move to and from the buddy lists MAG_BATCH at a time.
+#define MAG_LEVELS 3
+#define MAG_SIZE 32
+#define MAG_BATCH 16
+
+// Pages zeroed ahead of time by idle CPUs, about this many per type
+#define ZERO_POOL 256
+
+// Memory is divided into pageblocks of 2^PB_ORDER pages, each owned by
+// one migrate type. Free blocks are listed by the type of their
+// pageblock and allocations take from their own type first, so kernel
+// memory, which never moves, stays packed into few pageblocks, and the
+// user pages left in a fragmented one can be moved out by buddy_compact().
+#define PB_ORDER 9
+#define PAGEBLOCKS ((PAGES + (1 << PB_ORDER) - 1) >> PB_ORDER)
+
+// Regions a compaction pass tries before it gives up; a failed pass makes
+// this many following ones give up at once
+#define COMPACT_TRIES 4
+#define COMPACT_DEFER 64
+
+// order[] of the first page of an allocated block; free blocks keep
+// just their level there. ORDER_MOVABLE marks MIGRATE_MOVABLE blocks,
+// which compaction may move whatever pageblock they are in.
+#define ORDER_USED 0x80
+#define ORDER_MOVABLE 0x40
+#define ORDER_LVL 0x3f
+
 extern char end[];
 
-enum node_state {
-    NOTEXIST = 0,
-    USEDNODE = 1,
-    INNERNODE = 2,
-    FREENODE = 3
+// Free blocks are linked through their own first bytes, so the lists
+// cost no metadata.
+struct free_block {
+    struct free_block* prev;
+    struct free_block* next;
 };
 
-struct node {
-    enum node_state state;
-    int id;
-    int size;
-    int lvl;  
-    struct node* left_child;
-    struct node* right_child;
-    struct node* prev;
-    struct node* next;
-    struct node* parent;
-    struct node* neighbour;
-    char* memory;
+// Block i of level lvl covers pages [i << lvl, (i + 1) << lvl) and is
+// free iff its bit in free_map is set; the levels' bitmaps are packed
+// one after another, PAGES >> lvl bits each. Everything is indexed by
+// page number, (pa - KERNBASE) / PGSIZE, so no lookup ever walks a tree:
+// under 2 bits and 1 byte per page instead of two 72-byte nodes.
+struct {
+    struct spinlock lock;
+    int first;              // first page after the kernel
+    int total;              // pages managed, first .. PAGES - 1
+    uint8 order[PAGES];
+    uint64 free_map[(2 * PAGES + 63) / 64];
+    uint8 pb_type[PAGEBLOCKS];
+    struct free_block* lists[NMIGRATE][DEPTH];
+    int sizes[DEPTH];       // free blocks of all types
+    uint64 allocs;          // of blocks too big for the magazines
+    uint64 frees;
+#ifdef ALLOCTRACK
+    // Return address of the call that allocated the block starting at
+    // each page, 0 while nobody outside this file holds it. Written by
+    // the owner of the block without the lock.
+    uint64 site[PAGES];
+#endif
+} buddy_metadata;
+
+// Blocks in a magazine stay allocated as far as the buddy lists are
+// concerned; only the owning CPU touches its magazines, except when
+// another CPU has run out of memory and takes everything back
+// (reclaim_magazines), hence the lock.
+struct magazine {
+    int count;
+    void* blocks[MAG_SIZE];
 };
 
 struct {
     struct spinlock lock;
-    struct node nodes[NODES];
-    struct node* lists[DEPTH];
-    int sizes[DEPTH];
-} buddy_metadata;
+    struct magazine mags[NMIGRATE][MAG_LEVELS];
+    uint64 allocs;          // through the magazines
+    uint64 frees;
+} cpu_cache[NCPU];
+
+// Pre-zeroed pages for buddy_alloc_zeroed(), filled by buddy_zero_idle().
+// Like magazine blocks they are allocated as far as the buddy lists are
+// concerned. They are linked through their first word, which is cleared
+// again when a page is taken.
+struct {
+    struct spinlock lock;
+    void** pages[NMIGRATE];
+    int count[NMIGRATE];
+    uint64 allocs;
+} zero_pool;
+
+// One compaction pass at a time: the free blocks in the region are taken
+// off the lists, migrate_pages() moves the user pages out of it and hands
+// each old page to buddy_capture(), and if that took every page the
+// region is free as a whole. taken marks the region's pages held by the
+// pass, by their offset from lo. The lock only guards running and the
+// counters; a pass runs without it.
+struct {
+    struct spinlock lock;
+    int running;            // a pass is going on
+    int lo;
+    uint64 taken[(1 << PB_ORDER) / 64];
+    int deferred;
+    uint64 ok;
+    uint64 failed;
+} compactor;
+
+// User pages that fork() shares copy-on-write: how many page tables
+// map each page besides the first, 0 for a page mapped once. Whoever
+// unmaps a page last frees it.
+struct {
+    struct spinlock lock;
+    uint8 count[PAGES];
+} page_refs;
+
+int page_index(void* pa) {
+    return ((uint64)pa - KERNBASE) / PGSIZE;
+}
 
+char* page_address(int idx) {
+    return (char*)(KERNBASE + (uint64)idx * PGSIZE);
+}
+
+int free_bit(int idx, int lvl) {
+    return 2 * PAGES - ((2 * PAGES) >> lvl) + (idx >> lvl);
+}
+
+int is_free(int idx, int lvl) {
+    int bit = free_bit(idx, lvl);
+    return (buddy_metadata.free_map[bit / 64] >> (bit % 64)) & 1;
+}
+
+int block_type(int idx) {
+    return buddy_metadata.pb_type[idx >> PB_ORDER];
+}
 
-void add_free_node(struct node* n) {
-    buddy_metadata.sizes[n->lvl]++;
-    n->next = buddy_metadata.lists[n->lvl];
-    buddy_metadata.lists[n->lvl] = n;
-    n->prev = 0;
-    if (n->next != 0) {
-        n->next->prev = n;
+// Gives the pageblocks of the 2^lvl pages at idx (lvl >= PB_ORDER) the
+// type of the first one, so a block spanning several is of one type.
+void set_type(int idx, int lvl, int type) {
+    for (int pb = idx >> PB_ORDER; pb < (idx + (1 << lvl)) >> PB_ORDER; pb++) {
+        buddy_metadata.pb_type[pb] = type;
+    }
+}
+
+void add_free_block(int idx, int lvl) {
+    struct free_block* b = (struct free_block*)page_address(idx);
+    int bit = free_bit(idx, lvl);
+    if (lvl > PB_ORDER) {
+        set_type(idx, lvl, block_type(idx));
+    }
+    struct free_block** list = &buddy_metadata.lists[block_type(idx)][lvl];
+    buddy_metadata.free_map[bit / 64] |= 1UL << (bit % 64);
+    buddy_metadata.order[idx] = lvl;
+    buddy_metadata.sizes[lvl]++;
+    b->prev = 0;
+    b->next = *list;
+    if (b->next != 0) {
+        b->next->prev = b;
+    }
+    *list = b;
+}
+
+void remove_free_block(int idx, int lvl) {
+    struct free_block* b = (struct free_block*)page_address(idx);
+    int bit = free_bit(idx, lvl);
+    buddy_metadata.free_map[bit / 64] &= ~(1UL << (bit % 64));
+    buddy_metadata.sizes[lvl]--;
+    if (b->prev) {
+        b->prev->next = b->next;
+    } else {
+        buddy_metadata.lists[block_type(idx)][lvl] = b->next;
+    }
+    if (b->next) {
+        b->next->prev = b->prev;
     }
 }
 
@@ -68,7 +209,7 @@ void print_cur_info() {
         free += (buddy_metadata.sizes[i] << i);
         i++;
     }
-    printf("used = %d, free = %d, sizes: ", PAGES - free, free);
+    printf("used = %d, free = %d, sizes: ", buddy_metadata.total - free, free);
     for (int i = 0; i < 9; ++i) {
         printf("%d, ", sizes[i]);
     }
@@ -77,114 +218,130 @@ void print_cur_info() {
 
 void buddy_init() {
     initlock(&buddy_metadata.lock, "buddy_mem");
+    for (int i = 0; i < NCPU; i++) {
+        initlock(&cpu_cache[i].lock, "buddy_cpu");
+        for (int type = 0; type < NMIGRATE; type++) {
+            for (int lvl = 0; lvl < MAG_LEVELS; lvl++) {
+                cpu_cache[i].mags[type][lvl].count = 0;
+            }
+        }
+        cpu_cache[i].allocs = 0;
+        cpu_cache[i].frees = 0;
+    }
     int idx = 0;
     while (idx < DEPTH) {
-        buddy_metadata.lists[idx] = 0;
+        for (int type = 0; type < NMIGRATE; type++) {
+            buddy_metadata.lists[type][idx] = 0;
+        }
         buddy_metadata.sizes[idx] = 0;
         idx++;
     }
-
-    struct node* current_node = &buddy_metadata.nodes[0];
-    current_node->state = FREENODE;
-    current_node->id = 0;
-    current_node->size = PAGES;
-    current_node->lvl = DEPTH - 1;
-    current_node->left_child = &buddy_metadata.nodes[1];
-    current_node->right_child = &buddy_metadata.nodes[2];
-    current_node->prev = 0;
-    current_node->next = 0;
-    current_node->parent = current_node;
-    current_node->neighbour = current_node;
-    current_node->memory = (char*)PGROUNDUP((uint64)end);
-    add_free_node(&buddy_metadata.nodes[0]);
-
-    int id = 1;
-    while (id < NODES) {
-        current_node = &buddy_metadata.nodes[id];
-        struct node* parent = &buddy_metadata.nodes[(id - 1) / 2];
-        current_node->state = NOTEXIST; 
-        current_node->id = id;
-        current_node->lvl = parent->lvl - 1;
-        current_node->size = parent->size / 2;
-        
-        if (id < NODES / 2) {
-            current_node->left_child = &buddy_metadata.nodes[2 * id + 1];
-            current_node->right_child = &buddy_metadata.nodes[2 * id + 2];
-        } else {
-            current_node->left_child = 0;
-            current_node->right_child = 0;
+    // most memory ends up in user pages; the kernel claims pageblocks as
+    // it needs them
+    for (idx = 0; idx < PAGEBLOCKS; idx++) {
+        buddy_metadata.pb_type[idx] = MIGRATE_MOVABLE;
+    }
+    buddy_metadata.allocs = 0;
+    buddy_metadata.frees = 0;
+    initlock(&zero_pool.lock, "buddy_zero");
+    for (int type = 0; type < NMIGRATE; type++) {
+        zero_pool.pages[type] = 0;
+        zero_pool.count[type] = 0;
+    }
+    zero_pool.allocs = 0;
+    initlock(&page_refs.lock, "buddy_refs");
+    initlock(&compactor.lock, "buddy_compact");
+    compactor.running = 0;
+    compactor.deferred = 0;
+    compactor.ok = 0;
+    compactor.failed = 0;
+
+    // [end, PHYSTOP) as a forest: at every page, the biggest block that
+    // is aligned there and still fits
+    buddy_metadata.first = page_index((void*)PGROUNDUP((uint64)end));
+    buddy_metadata.total = PAGES - buddy_metadata.first;
+    idx = buddy_metadata.first;
+    while (idx < PAGES) {
+        int lvl = DEPTH - 1;
+        while ((idx & ((1 << lvl) - 1)) != 0 || idx + (1 << lvl) > PAGES) {
+            lvl--;
         }
-        
-        current_node->prev = 0;
-        current_node->next = 0;
+        add_free_block(idx, lvl);
+        idx += 1 << lvl;
+    }
+}
 
-        current_node->parent = parent;
-        if (id % 2 == 1) {
-            current_node->neighbour = &buddy_metadata.nodes[id + 1];
+// Splits the allocated block of level lvl at head into allocated blocks
+// of decreasing size, so that page idx inside it becomes an allocated
+// block of its own. Only order[] changes. Caller holds buddy_metadata.lock.
+void isolate_page(int head, int lvl, int idx) {
+    int used = ORDER_USED | (buddy_metadata.order[head] & ORDER_MOVABLE);
+    while (lvl > 0) {
+        lvl--;
+        int half = head + (1 << lvl);
+#ifdef ALLOCTRACK
+        buddy_metadata.site[half] = buddy_metadata.site[head];
+#endif
+        if (idx >= half) {
+            buddy_metadata.order[head] = lvl | used;
+            head = half;
         } else {
-            current_node->neighbour = &buddy_metadata.nodes[id - 1];
+            buddy_metadata.order[half] = lvl | used;
         }
-        
-        if (id % 2 == 1) {
-            current_node->memory = parent->memory;
-        } else {
-            current_node->memory = parent->memory + current_node->size * PGSIZE;
-        }
-
-        id++;
     }
+    buddy_metadata.order[idx] = used;
 }
 
+// Level of the allocated block holding page idx, or -1. Blocks are
+// aligned, so that block starts at idx rounded down to its level.
+// Caller holds buddy_metadata.lock.
+int used_block_level(int idx) {
+    for (int lvl = 0; lvl < DEPTH; lvl++) {
+        if ((buddy_metadata.order[idx & ~((1 << lvl) - 1)] & ~ORDER_MOVABLE) == (lvl | ORDER_USED)) {
+            return lvl;
+        }
+    }
+    return -1;
+}
 
-void buddy_free(void *pa) {
-    if (pa == 0 || ((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP) { 
+// Level of the allocated block starting at pa. Lock-free: order[] of an
+// allocated block only changes when that block itself is freed.
+int block_level(void *pa) {
+    if (pa == 0 || ((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP) {
         panic("buddy_free");
     }
 
-    acquire(&buddy_metadata.lock);
-
-    struct node* current_node = &buddy_metadata.nodes[0];
-    while (current_node->state == INNERNODE) {
-        if (current_node->right_child->memory > (char*)pa) {
-            current_node = current_node->left_child;
-        } else {
-            current_node = current_node->right_child;
-        }
-    }
-    
-    if (current_node->state != USEDNODE || current_node->memory != (char*)pa) {
+    int idx = page_index(pa);
+    if (idx < buddy_metadata.first || idx >= PAGES || !(buddy_metadata.order[idx] & ORDER_USED)) {
         panic("buddy_free");
     }
+    return buddy_metadata.order[idx] & ORDER_LVL;
+}
 
-    if (current_node->id == 0) {
-        add_free_node(current_node);
-        current_node->state = FREENODE;
-        release(&buddy_metadata.lock);
-        return;
+// Number of pages in the allocated block that starts at pa, or 0 if no
+// block starts there. Lock-free, for the owner of the block.
+int buddy_block_pages(void *pa) {
+    int idx = page_index(pa);
+    if (idx < buddy_metadata.first || idx >= PAGES || !(buddy_metadata.order[idx] & ORDER_USED)) {
+        return 0;
     }
-    
-    while (current_node->id && current_node->neighbour->state == 3) {
-        current_node->state = NOTEXIST;
-        current_node->neighbour->state = NOTEXIST;
+    return 1 << (buddy_metadata.order[idx] & ORDER_LVL);
+}
 
-        if (current_node->neighbour->prev) {
-            current_node->neighbour->prev->next = current_node->neighbour->next;
-        } else {
-            buddy_metadata.lists[current_node->neighbour->lvl] = current_node->neighbour->next;
+// Caller holds buddy_metadata.lock.
+void free_block(void *pa, int lvl) {
+    int idx = page_index(pa);
+    buddy_metadata.order[idx] = lvl;
+    while (lvl < DEPTH - 1) {
+        int buddy = idx ^ (1 << lvl);
+        if (!is_free(buddy, lvl)) {
+            break;
         }
-
-        if (current_node->neighbour->next)
-            current_node->neighbour->next->prev = current_node->neighbour->prev;
-
-        buddy_metadata.sizes[current_node->neighbour->lvl]--;
-        current_node->neighbour->prev = 0;
-        current_node->neighbour->next = 0;
-        current_node = current_node->parent;
+        remove_free_block(buddy, lvl);
+        idx &= ~(1 << lvl);
+        lvl++;
     }
-
-    add_free_node(current_node);
-    current_node->state = FREENODE;
-    release(&buddy_metadata.lock);
+    add_free_block(idx, lvl);
 }
 
 int is_deg_2(int n) {
@@ -197,61 +354,593 @@ int is_deg_2(int n) {
         pow2 *= 2;
         lvl++;
     }
-    
+
     if (n != pow2) {
         return -1;
     } else {
         return lvl;
-    } 
+    }
 }
 
-void* buddy_alloc(int n) {
+// Free pages in the 2^lvl pages at lo, walking the blocks that tile
+// it; *movable says if everything allocated there can be moved.
+// Caller holds buddy_metadata.lock, and no free block holds the region.
+int region_free(int lo, int lvl, int* movable) {
+    *movable = 1;
+    if (used_block_level(lo) > lvl) {
+        *movable = 0;
+        return 0;
+    }
+    int free = 0;
+    for (int idx = lo; idx < lo + (1 << lvl); idx += 1 << (buddy_metadata.order[idx] & ORDER_LVL)) {
+        int o = buddy_metadata.order[idx];
+        if (o & ORDER_USED) {
+            *movable &= (o & ORDER_MOVABLE) != 0;
+        } else if (is_free(idx, o)) {
+            free += 1 << o;
+        }
+    }
+    return free;
+}
+
+// Gives the pageblock at idx to type, moving its free blocks over to
+// that type's lists. Caller holds buddy_metadata.lock.
+void claim_pageblock(int idx, int type) {
+    int old = block_type(idx);
+    for (int i = idx; i < idx + (1 << PB_ORDER); i += 1 << (buddy_metadata.order[i] & ORDER_LVL)) {
+        int o = buddy_metadata.order[i];
+        if (!(o & ORDER_USED) && is_free(i, o)) {
+            remove_free_block(i, o);
+            buddy_metadata.pb_type[idx >> PB_ORDER] = type;
+            add_free_block(i, o);
+            buddy_metadata.pb_type[idx >> PB_ORDER] = old;
+        }
+    }
+    buddy_metadata.pb_type[idx >> PB_ORDER] = type;
+}
+
+// The smallest free block of the given type that fits; failing that,
+// the biggest one of another type, so that one whole pageblock changes
+// type rather than pieces of many getting mixed.
+// Caller holds buddy_metadata.lock.
+void* alloc_block(int lvl, int type) {
+    int from = type;
+    int split_lvl = lvl;
+    while (split_lvl < DEPTH && buddy_metadata.lists[type][split_lvl] == 0) {
+        split_lvl++;
+    }
+    for (int other = 0; split_lvl == DEPTH && other < NMIGRATE; other++) {
+        if (other == type) {
+            continue;
+        }
+        split_lvl = DEPTH - 1;
+        while (split_lvl >= lvl && buddy_metadata.lists[other][split_lvl] == 0) {
+            split_lvl--;
+        }
+        if (split_lvl < lvl) {
+            split_lvl = DEPTH;
+        } else {
+            from = other;
+        }
+    }
+    if (split_lvl == DEPTH) {
+        return 0;
+    }
+
+    int idx = page_index(buddy_metadata.lists[from][split_lvl]);
+    if (from != type && split_lvl < PB_ORDER) {
+        // take over the whole pageblock if it is mostly free, rather
+        // than leave it half kernel, half user memory
+        int pb = idx & ~((1 << PB_ORDER) - 1);
+        int movable;
+        if (region_free(pb, PB_ORDER, &movable) >= (1 << PB_ORDER) / 2) {
+            claim_pageblock(pb, type);
+            from = type;
+        }
+    }
+    remove_free_block(idx, split_lvl);
+    while (split_lvl > lvl) {
+        // the halves split off above a whole pageblock keep its old type,
+        // the ones below get the new one
+        if (split_lvl == PB_ORDER && from != type) {
+            set_type(idx, PB_ORDER, type);
+        }
+        split_lvl--;
+        add_free_block(idx + (1 << split_lvl), split_lvl);
+    }
+    if (lvl >= PB_ORDER && from != type) {
+        set_type(idx, lvl, type);
+    }
+    buddy_metadata.order[idx] = lvl | ORDER_USED | (type == MIGRATE_MOVABLE ? ORDER_MOVABLE : 0);
+
+    return page_address(idx);
+}
+
+// Gives every block cached by any CPU back to the buddy lists, so that
+// memory parked on idle CPUs is not reported as exhausted. Caller holds
+// no locks.
+void reclaim_magazines() {
+    for (int i = 0; i < NCPU; i++) {
+        acquire(&cpu_cache[i].lock);
+        acquire(&buddy_metadata.lock);
+        for (int type = 0; type < NMIGRATE; type++) {
+            for (int lvl = 0; lvl < MAG_LEVELS; lvl++) {
+                struct magazine* mag = &cpu_cache[i].mags[type][lvl];
+                while (mag->count > 0) {
+                    free_block(mag->blocks[--mag->count], lvl);
+                }
+            }
+        }
+        release(&buddy_metadata.lock);
+        release(&cpu_cache[i].lock);
+    }
+}
+
+// Gives the pre-zeroed pages back as well. Caller holds no locks.
+void reclaim_zero_pool() {
+    acquire(&zero_pool.lock);
+    acquire(&buddy_metadata.lock);
+    for (int type = 0; type < NMIGRATE; type++) {
+        while (zero_pool.pages[type]) {
+            void** pa = zero_pool.pages[type];
+            zero_pool.pages[type] = *pa;
+            free_block(pa, 0);
+        }
+        zero_pool.count[type] = 0;
+    }
+    release(&buddy_metadata.lock);
+    release(&zero_pool.lock);
+}
+
+void buddy_free(void *pa) {
+    int lvl = block_level(pa);
+    buddy_track(pa, 0);
+
+    if (lvl < MAG_LEVELS) {
+        push_off();
+        int id = cpuid();
+        struct magazine* mag = &cpu_cache[id].mags[block_type(page_index(pa))][lvl];
+        acquire(&cpu_cache[id].lock);
+        if (mag->count == MAG_SIZE) {
+            acquire(&buddy_metadata.lock);
+            for (int i = 0; i < MAG_BATCH; i++) {
+                free_block(mag->blocks[--mag->count], lvl);
+            }
+            release(&buddy_metadata.lock);
+        }
+        mag->blocks[mag->count++] = pa;
+        cpu_cache[id].frees++;
+        release(&cpu_cache[id].lock);
+        pop_off();
+        return;
+    }
+
+    acquire(&buddy_metadata.lock);
+    free_block(pa, lvl);
+    buddy_metadata.frees++;
+    release(&buddy_metadata.lock);
+}
+
+// Frees the single page pa of whatever allocated block holds it: the
+// block is split into allocated blocks around pa first. uvmalloc maps
+// whole blocks, but a process may give them back a page at a time.
+void buddy_free_page(void *pa) {
+    if (pa == 0 || ((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP) {
+        panic("buddy_free_page");
+    }
+
+    int idx = page_index(pa);
+    acquire(&buddy_metadata.lock);
+    int lvl = used_block_level(idx);
+    if (lvl < 0) {
+        panic("buddy_free_page");
+    }
+    isolate_page(idx & ~((1 << lvl) - 1), lvl, idx);
+    release(&buddy_metadata.lock);
+
+    buddy_free(pa);
+}
+
+// buddy_alloc_type() without noting the caller.
+void* alloc_pages(int n, int type) {
     int lvl = is_deg_2(n);
     if (lvl == -1) {
         return 0;
     }
 
+    if (lvl < MAG_LEVELS) {
+        for (int attempt = 0; attempt < 2; attempt++) {
+            push_off();
+            int id = cpuid();
+            struct magazine* mag = &cpu_cache[id].mags[type][lvl];
+            acquire(&cpu_cache[id].lock);
+            if (mag->count == 0) {
+                acquire(&buddy_metadata.lock);
+                void* block;
+                while (mag->count < MAG_BATCH && (block = alloc_block(lvl, type)) != 0) {
+                    mag->blocks[mag->count++] = block;
+                }
+                release(&buddy_metadata.lock);
+            }
+            void* block = 0;
+            if (mag->count > 0) {
+                block = mag->blocks[--mag->count];
+                cpu_cache[id].allocs++;
+                // a block freed into this magazine may have been
+                // allocated as the other type; the bit is the owner's
+                // to write, like the rest of an allocated block's order[]
+                uint8* o = &buddy_metadata.order[page_index(block)];
+                *o = (*o & ~ORDER_MOVABLE) | (type == MIGRATE_MOVABLE ? ORDER_MOVABLE : 0);
+            }
+            release(&cpu_cache[id].lock);
+            pop_off();
+            if (block) {
+                return block;
+            }
+            slab_reclaim();
+            reclaim_magazines();
+            reclaim_zero_pool();
+        }
+        return 0;
+    }
+
     acquire(&buddy_metadata.lock);
+    void* block = alloc_block(lvl, type);
+    if (block == 0) {
+        release(&buddy_metadata.lock);
+        slab_reclaim();
+        reclaim_magazines();
+        reclaim_zero_pool();
+        acquire(&buddy_metadata.lock);
+        block = alloc_block(lvl, type);
+    }
+    if (block) {
+        buddy_metadata.allocs++;
+    }
+    release(&buddy_metadata.lock);
+    return block;
+}
 
-    int split_lvl = -1;
-    int idx = lvl;
-    while (idx < DEPTH) {
-        if (buddy_metadata.sizes[idx] > 0) {
-            split_lvl = idx;
-            break;
+// n pages of memory of the given migrate type: MIGRATE_MOVABLE for user
+// pages, which buddy_compact() may move, MIGRATE_UNMOVABLE for the rest.
+void* buddy_alloc_type(int n, int type) {
+    void* pa = alloc_pages(n, type);
+    buddy_track(pa, __builtin_return_address(0));
+    return pa;
+}
+
+// Kernel memory.
+void* buddy_alloc(int n) {
+    void* pa = alloc_pages(n, MIGRATE_UNMOVABLE);
+    buddy_track(pa, __builtin_return_address(0));
+    return pa;
+}
+
+// Like buddy_alloc_type(), but the memory is zeroed. Single pages come
+// from the pre-zeroed pool while it lasts.
+void* buddy_alloc_zeroed(int n, int type) {
+    if (n == 1) {
+        acquire(&zero_pool.lock);
+        void** pa = zero_pool.pages[type];
+        if (pa) {
+            zero_pool.pages[type] = *pa;
+            zero_pool.count[type]--;
+            zero_pool.allocs++;
+        }
+        release(&zero_pool.lock);
+        if (pa) {
+            *pa = 0;
+            buddy_track(pa, __builtin_return_address(0));
+            return pa;
         }
-        idx++;
     }
 
-    if (split_lvl == -1) {
-        printf("There are no free node for alloc\n");
-        release(&buddy_metadata.lock);
+    void* pa = alloc_pages(n, type);
+    if (pa) {
+        memset(pa, 0, n * PGSIZE);
+    }
+    buddy_track(pa, __builtin_return_address(0));
+    return pa;
+}
+
+// Called by the scheduler when it found nothing to run: zeroes one free
+// page into the pool, outside of any lock. Never reclaims memory, and
+// stops while free pages are short (memory is then better spent on
+// real allocations) or are all in megapage-sized blocks.
+void buddy_zero_idle() {
+    // unlocked reads: a stale answer only means a page more or less, and
+    // idle CPUs must not hammer the buddy lock
+    int type = 0;
+    while (type < NMIGRATE && zero_pool.count[type] >= ZERO_POOL) {
+        type++;
+    }
+    if (type == NMIGRATE) {
+        return;
+    }
+    int free = 0;
+    for (int lvl = 0; lvl < DEPTH; lvl++) {
+        free += buddy_metadata.sizes[lvl] << lvl;
+    }
+    if (free <= buddy_metadata.total / 8) {
+        return;
+    }
+
+    // only from blocks below a megapage: splitting one for the pool
+    // would cost a megapage fault a compaction pass
+    acquire(&buddy_metadata.lock);
+    int lvl = 0;
+    while (lvl < PB_ORDER && buddy_metadata.lists[type][lvl] == 0) {
+        lvl++;
+    }
+    void** pa = lvl < PB_ORDER ? alloc_block(0, type) : 0;
+    release(&buddy_metadata.lock);
+    if (pa == 0) {
+        return;
+    }
+
+    memset(pa, 0, PGSIZE);
+    acquire(&zero_pool.lock);
+    *pa = zero_pool.pages[type];
+    zero_pool.pages[type] = pa;
+    zero_pool.count[type]++;
+    release(&zero_pool.lock);
+}
+
+// Whether page idx of the region being compacted is held by the pass.
+int taken(int idx) {
+    int off = idx - compactor.lo;
+    return (compactor.taken[off / 64] >> (off % 64)) & 1;
+}
+
+void take(int idx, int n) {
+    for (int off = idx - compactor.lo; n > 0; off++, n--) {
+        compactor.taken[off / 64] |= 1UL << (off % 64);
+    }
+}
+
+// For migrate_pages(): the user page pa was copied elsewhere, and
+// instead of being freed it now belongs to the compaction pass.
+void buddy_capture(void* pa) {
+    int idx = page_index(pa);
+    acquire(&buddy_metadata.lock);
+    int lvl = used_block_level(idx);
+    if (lvl < 0 || idx < compactor.lo || idx >= compactor.lo + (1 << PB_ORDER)) {
+        panic("buddy_capture");
+    }
+    isolate_page(idx & ~((1 << lvl) - 1), lvl, idx);
+    take(idx, 1);
+    buddy_track(pa, 0);
+    release(&buddy_metadata.lock);
+}
+
+// Takes the free blocks of the region at lo off the lists.
+// Caller holds buddy_metadata.lock.
+void capture_region(int lo, int lvl) {
+    compactor.lo = lo;
+    for (int i = 0; i < (1 << PB_ORDER) / 64; i++) {
+        compactor.taken[i] = 0;
+    }
+    for (int idx = lo; idx < lo + (1 << lvl); idx += 1 << (buddy_metadata.order[idx] & ORDER_LVL)) {
+        int o = buddy_metadata.order[idx];
+        if (!(o & ORDER_USED) && is_free(idx, o)) {
+            remove_free_block(idx, o);
+            buddy_metadata.order[idx] = o | ORDER_USED;
+            take(idx, 1 << o);
+        }
+    }
+}
+
+// Frees what the pass holds of the region at lo; if that was all of it,
+// the region is one free block now, and a block of its size is returned
+// allocated. Caller holds buddy_metadata.lock.
+void* release_region(int lo, int lvl) {
+    int all = 1;
+    for (int idx = lo; idx < lo + (1 << lvl); idx++) {
+        all &= taken(idx);
+    }
+    for (int idx = lo; idx < lo + (1 << lvl); idx += 1 << (buddy_metadata.order[idx] & ORDER_LVL)) {
+        int o = buddy_metadata.order[idx];
+        if ((o & ORDER_USED) && taken(idx)) {
+            free_block(page_address(idx), o & ORDER_LVL);
+        }
+    }
+    return all ? alloc_block(lvl, MIGRATE_MOVABLE) : 0;
+}
+
+// Tries to make a free block of n pages (at most a pageblock) by moving
+// the user pages out of the region of that size with the most free
+// memory and nothing unmovable in it, and returns the block allocated,
+// as MIGRATE_MOVABLE. Meant for when a big buddy_alloc_type() failed;
+// the caller must hold no spinlocks, since migrate_pages() takes every
+// process's lock. Gives up at once while another pass is running.
+void* buddy_compact(int n) {
+    int lvl = is_deg_2(n);
+    if (lvl <= 0 || lvl > PB_ORDER) {
+        return 0;
+    }
+
+    acquire(&compactor.lock);
+    if (compactor.running) {
+        release(&compactor.lock);
+        return 0;
+    }
+    if (compactor.deferred > 0) {
+        compactor.deferred--;
+        release(&compactor.lock);
         return 0;
     }
+    compactor.running = 1;
+    release(&compactor.lock);
+    // blocks parked in caches are free memory the pass can use
+    slab_reclaim();
+    reclaim_magazines();
+    reclaim_zero_pool();
+
+    acquire(&buddy_metadata.lock);
+    void* block = alloc_block(lvl, MIGRATE_MOVABLE);
+    int tried[COMPACT_TRIES];
+    for (int t = 0; t < COMPACT_TRIES && block == 0; t++) {
+        int best = -1, best_free = 0;
+        int lo = (buddy_metadata.first + (1 << lvl) - 1) & ~((1 << lvl) - 1);
+        for (; lo + (1 << lvl) <= PAGES; lo += 1 << lvl) {
+            int seen = 0;
+            for (int i = 0; i < t; i++) {
+                seen |= tried[i] == lo;
+            }
+            int movable, free = region_free(lo, lvl, &movable);
+            if (!seen && movable && free > best_free) {
+                best = lo;
+                best_free = free;
+            }
+        }
+        if (best < 0) {
+            break;
+        }
+        tried[t] = best;
+        capture_region(best, lvl);
+        release(&buddy_metadata.lock);
 
-    struct node* current_node = buddy_metadata.lists[split_lvl];
+        migrate_pages((uint64)page_address(best), (uint64)page_address(best + (1 << lvl)));
 
-    if (current_node->prev) {
-        current_node->prev->next = current_node->next;
+        acquire(&buddy_metadata.lock);
+        block = release_region(best, lvl);
+    }
+    if (block) {
+        buddy_metadata.allocs++;
+    }
+    release(&buddy_metadata.lock);
+
+    acquire(&compactor.lock);
+    if (block) {
+        compactor.ok++;
     } else {
-        buddy_metadata.lists[current_node->lvl] = current_node->next;
+        compactor.failed++;
+        compactor.deferred = COMPACT_DEFER;
     }
+    compactor.running = 0;
+    release(&compactor.lock);
+    buddy_track(block, __builtin_return_address(0));
+    return block;
+}
 
-    if (current_node->next)
-        current_node->next->prev = current_node->prev;
-    buddy_metadata.sizes[current_node->lvl]--;
+// A snapshot for memstat(). Each CPU's counters are read under its own
+// lock, so the totals are only roughly simultaneous.
+void buddy_stat(struct buddy_stats* st) {
+    memset(st, 0, sizeof(*st));
+    acquire(&zero_pool.lock);
+    for (int type = 0; type < NMIGRATE; type++) {
+        st->zeroed += zero_pool.count[type];
+    }
+    st->allocs = zero_pool.allocs;
+    release(&zero_pool.lock);
+
+    acquire(&compactor.lock);
+    st->compact_ok = compactor.ok;
+    st->compact_failed = compactor.failed;
+    release(&compactor.lock);
+    for (int i = 0; i < NCPU; i++) {
+        acquire(&cpu_cache[i].lock);
+        for (int type = 0; type < NMIGRATE; type++) {
+            for (int lvl = 0; lvl < MAG_LEVELS; lvl++) {
+                st->cached += cpu_cache[i].mags[type][lvl].count << lvl;
+            }
+        }
+        st->allocs += cpu_cache[i].allocs;
+        st->frees += cpu_cache[i].frees;
+        st->cpu_lock_contended += cpu_cache[i].lock.ncontended;
+        release(&cpu_cache[i].lock);
+    }
 
-    current_node->prev = 0;
-    current_node->next = 0;
-    while (current_node->lvl > lvl) {
-        current_node->state = INNERNODE;
-        add_free_node(current_node->right_child);
-        current_node->right_child->state = FREENODE;
-        current_node = current_node->left_child;
+    acquire(&buddy_metadata.lock);
+    st->total = buddy_metadata.total;
+    st->free = st->cached + st->zeroed;
+    for (int lvl = 0; lvl < DEPTH; lvl++) {
+        st->free_by_size[lvl] = buddy_metadata.sizes[lvl];
+        st->free += (uint64)buddy_metadata.sizes[lvl] << lvl;
     }
-    current_node->state = USEDNODE; 
-    
+    st->allocs += buddy_metadata.allocs;
+    st->frees += buddy_metadata.frees;
+    st->lock_acquires = buddy_metadata.lock.nacquire;
+    st->lock_contended = buddy_metadata.lock.ncontended;
     release(&buddy_metadata.lock);
+}
 
-    return current_node->memory;
+// One more page table maps the user page pa.
+void buddy_share(void* pa) {
+    int idx = page_index(pa);
+    acquire(&page_refs.lock);
+    if (page_refs.count[idx] == 255) {
+        panic("buddy_share");
+    }
+    page_refs.count[idx]++;
+    release(&page_refs.lock);
+}
+
+// Does any other page table map the user page pa? Lock-free: a page
+// only gains sharers when a process that maps it forks, which the
+// caller, as one that maps it, is not doing.
+int buddy_shared(void* pa) {
+    return page_refs.count[page_index(pa)] > 0;
+}
+
+// Drops one page table's mapping of the user page pa. Returns 1 if
+// others still map it, 0 if the caller was the last and owns the page
+// now.
+int buddy_unshare(void* pa) {
+    int idx = page_index(pa);
+    int shared = 0;
+    acquire(&page_refs.lock);
+    if (page_refs.count[idx] > 0) {
+        page_refs.count[idx]--;
+        shared = 1;
+    }
+    release(&page_refs.lock);
+    return shared;
+}
+
+// Records pc as the caller that allocated the block at pa, or that
+// nobody holds it if pc is 0. kalloc() and the like pass on their own
+// caller. Does nothing unless built with ALLOCTRACK.
+void buddy_track(void* pa, void* pc) {
+#ifdef ALLOCTRACK
+    if (pa) {
+        buddy_metadata.site[page_index(pa)] = (uint64)pc;
+    }
+#endif
+}
+
+// Groups the allocated blocks by the call site that allocated them,
+// for allocsites(). Fills in up to max sites and returns how many were
+// filled in, or -1 without ALLOCTRACK. Blocks in the magazines and the
+// zero pool have no site and are left out.
+int buddy_sites(struct alloc_site* sites, int max) {
+#ifdef ALLOCTRACK
+    int n = 0;
+    acquire(&buddy_metadata.lock);
+    for (int idx = buddy_metadata.first; idx < PAGES; idx += 1 << (buddy_metadata.order[idx] & ORDER_LVL)) {
+        uint64 pc = buddy_metadata.site[idx];
+        if (!(buddy_metadata.order[idx] & ORDER_USED) || pc == 0) {
+            continue;
+        }
+        int i = 0;
+        while (i < n && sites[i].pc != pc) {
+            i++;
+        }
+        if (i == n) {
+            if (n == max) {
+                continue;
+            }
+            sites[n].pc = pc;
+            sites[n].blocks = 0;
+            sites[n].pages = 0;
+            n++;
+        }
+        sites[i].blocks++;
+        sites[i].pages += 1 << (buddy_metadata.order[idx] & ORDER_LVL);
+    }
+    release(&buddy_metadata.lock);
+    return n;
+#else
+    return -1;
+#endif
 }
@@ -84,6 +84,10 @@ consoleread(int user_dst, uint64 dst, int n)
   char cbuf;
 
   target = n;
+  // either_copyout() under cons.lock cannot read program pages in;
+  // a line that outruns the input buffer may end the read early
+  if(user_dst)
+    uvmprefault(dst, n < INPUT_BUF_SIZE ? n : INPUT_BUF_SIZE);
   acquire(&cons.lock);
   while(n > 0){
     // wait until interrupt handler has put some
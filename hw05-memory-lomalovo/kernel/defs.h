@@ -1,3 +1,6 @@
+struct allocbench;
+struct alloc_site;
+struct buddy_stats;
 struct buf;
 struct context;
 struct file;
@@ -8,6 +11,11 @@ struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct vmseg;
+
+// allocbench.c
+int             allocbench(struct allocbench *);
+void            allocbench_init(void);
 
 // bio.c
 void            binit(void);
@@ -24,6 +32,9 @@ void            consputc(int);
 
 // exec.c
 int             exec(char*, char**);
+int             loadfault(pagetable_t, struct vmseg*, uint64);
+void            segfree(struct vmseg*);
+void            segclip(struct vmseg*, uint64);
 
 // file.c
 struct file*    filealloc(void);
@@ -40,6 +51,8 @@ int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
+struct inode*   itextdup(struct inode*);
+void            itextput(struct inode*);
 void            iinit();
 void            ilock(struct inode*);
 void            iput(struct inode*);
@@ -61,13 +74,35 @@ void            ramdiskrw(struct buf*);
 
 // kalloc.c
 void*           kalloc(void);
+void*           kzalloc(void);
 void            kfree(void *);
 void            kinit(void);
 
 // buddy_alloc.c
+enum migratetype { MIGRATE_UNMOVABLE, MIGRATE_MOVABLE, NMIGRATE };
 void*           buddy_alloc(int);
+void*           buddy_alloc_type(int, int);
+void*           buddy_alloc_zeroed(int, int);
+void*           buddy_compact(int);
+void            buddy_capture(void *);
 void            buddy_free(void *);
 void            buddy_init(void);
+int             buddy_block_pages(void *);
+void            buddy_stat(struct buddy_stats *);
+void            buddy_zero_idle(void);
+void            buddy_free_page(void *);
+void            buddy_share(void *);
+int             buddy_shared(void *);
+int             buddy_unshare(void *);
+void            buddy_track(void *, void *);
+int             buddy_sites(struct alloc_site *, int);
+
+// slab.c
+enum kobj { KOBJ_TRAPFRAME, KOBJ_PIPE, NKOBJ };
+void*           slab_alloc(enum kobj);
+void            slab_free(void *);
+void            slab_init(void);
+void            slab_reclaim(void);
 
 // log.c
 void            initlog(int, struct superblock*);
@@ -111,6 +146,7 @@ void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
+void            migrate_pages(uint64, uint64);
 
 // swtch.S
 void            swtch(struct context*, struct context*);
@@ -170,9 +206,14 @@ void            uvmfirst(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64, int);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmcow(pagetable_t, uint64);
+int             uvmfault(struct proc*, uint64);
+void            uvmprefault(uint64, uint64);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
+void            uvmmigrate(pagetable_t, uint64, uint64);
 void            uvmclear(pagetable_t, uint64);
+int             uvmdemote(pagetable_t, uint64);
 pte_t *         walk(pagetable_t, uint64, int);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
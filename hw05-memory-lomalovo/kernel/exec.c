@@ -6,8 +6,9 @@
 #include "proc.h"
 #include "defs.h"
 #include "elf.h"
-
-static int loadseg(pde_t *, uint64, struct inode *, uint, uint);
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
 
 int flags2perm(int flags)
 {
@@ -29,8 +30,11 @@ exec(char *path, char **argv)
   struct inode *ip;
   struct proghdr ph;
   pagetable_t pagetable = 0, oldpagetable;
+  struct vmseg seg[NSEG], oldseg[NSEG];
+  int nseg = 0;
   struct proc *p = myproc();
 
+  memset(seg, 0, sizeof(seg));
   begin_op();
 
   if((ip = namei(path)) == 0){
@@ -49,11 +53,12 @@ exec(char *path, char **argv)
   if((pagetable = proc_pagetable(p)) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Record where the program's segments come from; loadfault()
+  // reads each page in when it is first used.
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
-    if(ph.type != ELF_PROG_LOAD)
+    if(ph.type != ELF_PROG_LOAD || ph.memsz == 0)
       continue;
     if(ph.memsz < ph.filesz)
       goto bad;
@@ -61,12 +66,19 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
-    uint64 sz1;
-    if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz, flags2perm(ph.flags))) == 0)
+    // a page belongs to one segment, and the stack must still fit
+    if(ph.vaddr < PGROUNDUP(sz) || ph.vaddr + ph.memsz > TRAPFRAME - 2*PGSIZE)
       goto bad;
-    sz = sz1;
-    if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(nseg == NSEG)
       goto bad;
+    seg[nseg].ip = itextdup(ip);
+    seg[nseg].va = ph.vaddr;
+    seg[nseg].memsz = ph.memsz;
+    seg[nseg].filesz = ph.filesz;
+    seg[nseg].off = ph.off;
+    seg[nseg].perm = flags2perm(ph.flags);
+    nseg++;
+    sz = ph.vaddr + ph.memsz;
   }
   iunlockput(ip);
   end_op();
@@ -124,9 +136,12 @@ exec(char *path, char **argv)
   oldpagetable = p->pagetable;
   p->pagetable = pagetable;
   p->sz = sz;
+  memmove(oldseg, p->seg, sizeof(oldseg));
+  memmove(p->seg, seg, sizeof(seg));
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
   proc_freepagetable(oldpagetable, oldsz);
+  segfree(oldseg);
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
@@ -137,30 +152,81 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
+  segfree(seg);
   return -1;
 }
 
-// Load a program segment into pagetable at virtual address va.
-// va must be page-aligned
-// and the pages from va to va+sz must already be mapped.
-// Returns 0 on success, -1 on failure.
-static int
-loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz)
+// Map the page at va of segment s in pagetable, reading the part
+// of it that is in the file. Returns 0, or -1 if memory ran out,
+// the file could not be read, or reading it would mean sleeping
+// under a spinlock or waiting for a buffer that the faulting
+// readi() of this file may hold (see uvmprefault()).
+int
+loadfault(pagetable_t pagetable, struct vmseg *s, uint64 va)
 {
-  uint i, n;
-  uint64 pa;
-
-  for(i = 0; i < sz; i += PGSIZE){
-    pa = walkaddr(pagetable, va + i);
-    if(pa == 0)
-      panic("loadseg: address should exist");
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, 0, (uint64)pa, offset+i, n) != n)
+  uint64 off;
+  uint n = 0;
+  char *mem;
+  int r;
+
+  va = PGROUNDDOWN(va);
+  off = va - s->va;
+  if(off < s->filesz)
+    n = s->filesz - off < PGSIZE ? s->filesz - off : PGSIZE;
+  if(n > 0 && (!intr_get() || holdingsleep(&s->ip->lock)))
+    return -1;
+  if((mem = buddy_alloc_type(1, MIGRATE_MOVABLE)) == 0)
+    return -1;
+  memset(mem + n, 0, PGSIZE - n);
+  if(n > 0){
+    ilock(s->ip);
+    r = readi(s->ip, 0, (uint64)mem, s->off + off, n);
+    iunlock(s->ip);
+    if(r != n){
+      buddy_free(mem);
       return -1;
+    }
+  }
+  if(mappages(pagetable, va, PGSIZE, (uint64)mem, s->perm | PTE_R | PTE_U) != 0){
+    buddy_free(mem);
+    return -1;
   }
-  
   return 0;
 }
+
+// Drop the references that the segments in seg[0..NSEG) hold to
+// their program files.
+void
+segfree(struct vmseg *seg)
+{
+  begin_op();
+  for(int i = 0; i < NSEG; i++){
+    if(seg[i].ip)
+      itextput(seg[i].ip);
+    seg[i].ip = 0;
+  }
+  end_op();
+}
+
+// The process has shrunk to sz: cut the segments in seg[0..NSEG)
+// down to the pages that are left, so that the pages above come
+// back as zeroed heap if it grows again.
+void
+segclip(struct vmseg *seg, uint64 sz)
+{
+  sz = PGROUNDUP(sz);
+  for(int i = 0; i < NSEG; i++){
+    if(seg[i].ip == 0 || seg[i].va + seg[i].memsz <= sz)
+      continue;
+    if(seg[i].va >= sz){
+      begin_op();
+      itextput(seg[i].ip);
+      end_op();
+      seg[i].ip = 0;
+      continue;
+    }
+    seg[i].memsz = sz - seg[i].va;
+    if(seg[i].filesz > seg[i].memsz)
+      seg[i].filesz = seg[i].memsz;
+  }
+}
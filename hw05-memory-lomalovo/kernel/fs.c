@@ -270,6 +270,7 @@ iget(uint dev, uint inum)
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
+  ip->text = 0;
   ip->valid = 0;
   release(&itable.lock);
 
@@ -287,6 +288,31 @@ idup(struct inode *ip)
   return ip;
 }
 
+// Like idup(), for a process segment that pages its program in
+// from ip: while any such reference is held, writes to ip are
+// refused, so that a running program never mixes the pages of two
+// versions of its file. The first such reference must be taken
+// with ip locked, so that no write is under way.
+struct inode*
+itextdup(struct inode *ip)
+{
+  acquire(&itable.lock);
+  ip->ref++;
+  ip->text++;
+  release(&itable.lock);
+  return ip;
+}
+
+// Drop a reference taken by itextdup(), like iput().
+void
+itextput(struct inode *ip)
+{
+  acquire(&itable.lock);
+  ip->text--;
+  release(&itable.lock);
+  iput(ip);
+}
+
 // Lock the given inode.
 // Reads the inode from disk if necessary.
 void
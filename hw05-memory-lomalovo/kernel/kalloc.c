@@ -54,5 +54,17 @@ kfree(void *pa)
 void *
 kalloc(void)
 {
-  return buddy_alloc(1);
+  void *pa = buddy_alloc(1);
+  buddy_track(pa, __builtin_return_address(0));
+  return pa;
+}
+
+// Allocate one zeroed 4096-byte page, from the pool of
+// pages that idle CPUs zeroed in advance if possible.
+void *
+kzalloc(void)
+{
+  void *pa = buddy_alloc_zeroed(1, MIGRATE_UNMOVABLE);
+  buddy_track(pa, __builtin_return_address(0));
+  return pa;
 }
@@ -17,6 +17,8 @@ main()
     printf("xv6 kernel is booting\n");
     printf("\n");
     kinit();         // physical page allocator
+    slab_init();     // small kernel object caches
+    allocbench_init(); // allocator benchmark
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
     procinit();      // process table
@@ -0,0 +1,27 @@
+// Physical memory allocator statistics, filled in by memstat() and
+// allocsites().
+
+#define MEMSTAT_ORDERS 15   // block sizes 2^0 .. 2^14 pages
+
+struct buddy_stats {
+  uint64 total;                         // pages managed by the allocator
+  uint64 free;                          // free pages, cached and zeroed included
+  uint64 cached;                        // free pages in per-CPU magazines
+  uint64 zeroed;                        // free pages in the pre-zeroed pool
+  uint64 free_by_size[MEMSTAT_ORDERS];  // free blocks of 2^i pages
+  uint64 allocs;                        // successful allocations
+  uint64 frees;                         // buddy_free() calls
+  uint64 lock_acquires;                 // of the global buddy lock
+  uint64 lock_contended;                // acquires of it that had to spin
+  uint64 cpu_lock_contended;            // the same for the per-CPU locks
+  uint64 compact_ok;                    // compaction passes that made a block
+  uint64 compact_failed;                // and those that did not
+};
+
+// The blocks one call site of the allocator holds, in kernels built
+// with ALLOCTRACK.
+struct alloc_site {
+  uint64 pc;                            // return address into the caller
+  uint64 blocks;                        // live blocks it allocated
+  uint64 pages;                         // and the pages in them
+};
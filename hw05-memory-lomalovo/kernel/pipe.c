@@ -8,17 +8,6 @@
 #include "sleeplock.h"
 #include "file.h"
 
-#define PIPESIZE 512
-
-struct pipe {
-  struct spinlock lock;
-  char data[PIPESIZE];
-  uint nread;     // number of bytes read
-  uint nwrite;    // number of bytes written
-  int readopen;   // read fd is still open
-  int writeopen;  // write fd is still open
-};
-
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -28,7 +17,7 @@ pipealloc(struct file **f0, struct file **f1)
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if((pi = (struct pipe*)kalloc()) == 0)
+  if((pi = (struct pipe*)slab_alloc(KOBJ_PIPE)) == 0)
     goto bad;
   pi->readopen = 1;
   pi->writeopen = 1;
@@ -47,7 +36,7 @@ pipealloc(struct file **f0, struct file **f1)
 
  bad:
   if(pi)
-    kfree((char*)pi);
+    slab_free(pi);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -68,7 +57,7 @@ pipeclose(struct pipe *pi, int writable)
   }
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
-    kfree((char*)pi);
+    slab_free(pi);
   } else
     release(&pi->lock);
 }
@@ -77,6 +66,7 @@ int
 pipewrite(struct pipe *pi, uint64 addr, int n)
 {
   int i = 0;
+  int faulted = 0;  // addr..addr+faulted is prefaulted
   struct proc *pr = myproc();
 
   acquire(&pi->lock);
@@ -88,6 +78,13 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
     if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
       wakeup(&pi->nread);
       sleep(&pi->nwrite, &pi->lock);
+    } else if(i == faulted){
+      // copyin() under pi->lock cannot read program pages in;
+      // a pipeful at a time, not all of a big write at once
+      release(&pi->lock);
+      faulted = n - i > PIPESIZE ? i + PIPESIZE : n;
+      uvmprefault(addr + i, faulted - i);
+      acquire(&pi->lock);
     } else {
       char ch;
       if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
@@ -109,6 +106,9 @@ piperead(struct pipe *pi, uint64 addr, int n)
   struct proc *pr = myproc();
   char ch;
 
+  // copyout() under pi->lock cannot read program pages in; no
+  // more than a pipeful can be read
+  uvmprefault(addr, n < PIPESIZE ? n : PIPESIZE);
   acquire(&pi->lock);
   while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
     if(killed(pr)){
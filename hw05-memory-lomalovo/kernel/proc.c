@@ -125,8 +125,8 @@ found:
   p->pid = allocpid();
   p->state = USED;
 
-  // Allocate a trapframe page.
-  if((p->trapframe = (struct trapframe *)kalloc()) == 0){
+  // Allocate a trapframe.
+  if((p->trapframe = (struct trapframe *)slab_alloc(KOBJ_TRAPFRAME)) == 0){
     freeproc(p);
     release(&p->lock);
     return 0;
@@ -156,7 +156,7 @@ static void
 freeproc(struct proc *p)
 {
   if(p->trapframe)
-    kfree((void*)p->trapframe);
+    slab_free(p->trapframe);
   p->trapframe = 0;
   if(p->pagetable)
     proc_freepagetable(p->pagetable, p->sz);
@@ -193,10 +193,11 @@ proc_pagetable(struct proc *p)
     return 0;
   }
 
-  // map the trapframe page just below the trampoline page, for
-  // trampoline.S.
+  // map the page holding the trapframe just below the trampoline
+  // page, for trampoline.S. Trapframes are slab objects, so the page
+  // is shared with other processes' trapframes; it is not PTE_U.
   if(mappages(pagetable, TRAPFRAME, PGSIZE,
-              (uint64)(p->trapframe), PTE_R | PTE_W) < 0){
+              PGROUNDDOWN((uint64)(p->trapframe)), PTE_R | PTE_W) < 0){
     uvmunmap(pagetable, TRAMPOLINE, 1, 0);
     uvmfree(pagetable, 0);
     return 0;
@@ -264,11 +265,16 @@ growproc(int n)
 
   sz = p->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
+    // the memory is mapped as it is first used, by uvmfault()
+    if(sz + n > TRAPFRAME)
       return -1;
-    }
+    sz += n;
   } else if(n < 0){
+    // a megapage across the new end has to be split first
+    if(uvmdemote(p->pagetable, PGROUNDUP(sz + n)) < 0)
+      return -1;
     sz = uvmdealloc(p->pagetable, sz, sz + n);
+    segclip(p->seg, sz);
   }
   p->sz = sz;
   return 0;
@@ -308,6 +314,13 @@ fork(void)
       np->ofile[i] = filedup(p->ofile[i]);
   np->cwd = idup(p->cwd);
 
+  // the child pages in the same program file
+  for(i = 0; i < NSEG; i++){
+    np->seg[i] = p->seg[i];
+    if(p->seg[i].ip)
+      np->seg[i].ip = itextdup(p->seg[i].ip);
+  }
+
   safestrcpy(np->name, p->name, sizeof(p->name));
 
   pid = np->pid;
@@ -360,6 +373,8 @@ exit(int status)
     }
   }
 
+  segfree(p->seg);
+
   begin_op();
   iput(p->cwd);
   end_op();
@@ -394,6 +409,9 @@ wait(uint64 addr)
   int havekids, pid;
   struct proc *p = myproc();
 
+  // the status is copied out under wait_lock
+  if(addr != 0)
+    uvmprefault(addr, sizeof(int));
   acquire(&wait_lock);
 
   for(;;){
@@ -452,9 +470,11 @@ scheduler(void)
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
 
+    int found = 0;
     for(p = proc; p < &proc[NPROC]; p++) {
       acquire(&p->lock);
       if(p->state == RUNNABLE) {
+        found = 1;
         // Switch to chosen process.  It is the process's job
         // to release its lock and then reacquire it
         // before jumping back to us.
@@ -468,6 +488,31 @@ scheduler(void)
       }
       release(&p->lock);
     }
+
+    // Nothing to run: zero a free page, so that the next
+    // sbrk, fork or exec does not have to.
+    if(!found)
+      buddy_zero_idle();
+  }
+}
+
+// Move the user pages in physical memory [lo, hi) of the
+// processes that are not running to other pages, for
+// buddy_compact(). A process preempted in the middle of kernel
+// code may be holding the physical address of one of its pages
+// (copyout(), uvmunmap()), so it is left alone; processes that
+// are sleeping or were preempted in user space are not.
+void
+migrate_pages(uint64 lo, uint64 hi)
+{
+  struct proc *p;
+
+  for(p = proc; p < &proc[NPROC]; p++){
+    acquire(&p->lock);
+    if((p->state == SLEEPING || p->state == ZOMBIE ||
+        (p->state == RUNNABLE && !p->kpreempted)) && p->pagetable)
+      uvmmigrate(p->pagetable, lo, hi);
+    release(&p->lock);
   }
 }
 
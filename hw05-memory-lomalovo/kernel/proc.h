@@ -81,6 +81,18 @@ struct trapframe {
 
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+// A program segment that exec() left in the file: its pages are
+// read in on first use, by loadfault(). The file cannot be written
+// while a segment refers to it (itextdup()).
+struct vmseg {
+  struct inode *ip;            // program file, 0 if the slot is unused
+  uint64 va;                   // page-aligned start
+  uint64 memsz;                // bytes in memory
+  uint64 filesz;               // bytes from the file, the rest is zero
+  uint off;                    // file offset of va
+  int perm;                    // PTE_X and PTE_W bits
+};
+
 // Per-process state
 struct proc {
   struct spinlock lock;
@@ -104,4 +116,6 @@ struct proc {
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
+  int kpreempted;              // Yielded in kernel code, see migrate_pages()
+  struct vmseg seg[NSEG];      // Program segments, paged in from the file
 };
@@ -0,0 +1,265 @@
+// Typed caches for small kernel objects on top of the buddy allocator.
+// A slab is one page: a struct slab header, then equally sized objects,
+// so slab_free() finds an object's slab (and its type) by rounding the
+// address down to the page.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "proc.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+
+#define SLAB_ALIGN 64       // objects start on their own cache lines
+#define SLAB_BUCKETS 8      // partial slabs grouped by how full they are
+#define SLAB_FULL -1
+#define SLAB_EMPTY -2
+#define CPU_OBJS 8          // objects cached per CPU and type
+#define CPU_BATCH 4
+
+struct slab {
+    struct slab* prev;
+    struct slab* next;
+    struct kcache* cache;
+    int inuse;
+    int bucket;             // index into partial[], SLAB_FULL or SLAB_EMPTY
+    void* free;             // free objects, linked through their first word
+};
+
+// At most one empty slab is kept per type, the rest go back to buddy_free.
+struct kcache {
+    struct spinlock lock;
+    char* name;
+    int size;
+    int per_slab;
+    struct slab* partial[SLAB_BUCKETS];
+    struct slab* full;
+    struct slab* empty;
+};
+
+struct kcache caches[NKOBJ];
+
+// Per-CPU object stacks; the lock is only contended when memory runs out
+// and slab_reclaim() empties every CPU's stack.
+struct {
+    struct spinlock lock;
+    int count;
+    void* objs[CPU_OBJS];
+} cpu_objs[NCPU][NKOBJ];
+
+void kcache_init(enum kobj type, char* name, int size) {
+    struct kcache* c = &caches[type];
+    initlock(&c->lock, name);
+    c->name = name;
+    c->size = (size + SLAB_ALIGN - 1) / SLAB_ALIGN * SLAB_ALIGN;
+    c->per_slab = (PGSIZE - SLAB_ALIGN) / c->size;
+    for (int i = 0; i < SLAB_BUCKETS; i++) {
+        c->partial[i] = 0;
+    }
+    c->full = 0;
+    c->empty = 0;
+}
+
+void slab_init() {
+    if (sizeof(struct slab) > SLAB_ALIGN) {
+        panic("slab_init");
+    }
+    kcache_init(KOBJ_TRAPFRAME, "slab_trapframe", sizeof(struct trapframe));
+    kcache_init(KOBJ_PIPE, "slab_pipe", sizeof(struct pipe));
+    for (int i = 0; i < NCPU; i++) {
+        for (int type = 0; type < NKOBJ; type++) {
+            initlock(&cpu_objs[i][type].lock, "slab_cpu");
+            cpu_objs[i][type].count = 0;
+        }
+    }
+}
+
+struct slab** slab_list(struct kcache* c, int bucket) {
+    if (bucket == SLAB_FULL) {
+        return &c->full;
+    }
+    if (bucket == SLAB_EMPTY) {
+        return &c->empty;
+    }
+    return &c->partial[bucket];
+}
+
+void slab_unlink(struct kcache* c, struct slab* s) {
+    if (s->prev) {
+        s->prev->next = s->next;
+    } else {
+        *slab_list(c, s->bucket) = s->next;
+    }
+    if (s->next) {
+        s->next->prev = s->prev;
+    }
+}
+
+void slab_link(struct kcache* c, struct slab* s, int bucket) {
+    struct slab** list = slab_list(c, bucket);
+    s->bucket = bucket;
+    s->prev = 0;
+    s->next = *list;
+    if (s->next) {
+        s->next->prev = s;
+    }
+    *list = s;
+}
+
+// Moves s to the list matching its fill level. An empty slab goes back to
+// the buddy allocator if the cache already holds one.
+// Caller holds c->lock.
+void slab_place(struct kcache* c, struct slab* s) {
+    int bucket;
+    if (s->inuse == 0) {
+        bucket = SLAB_EMPTY;
+    } else if (s->inuse == c->per_slab) {
+        bucket = SLAB_FULL;
+    } else {
+        bucket = s->inuse * SLAB_BUCKETS / c->per_slab;
+    }
+    if (bucket == s->bucket) {
+        return;
+    }
+    slab_unlink(c, s);
+    if (bucket == SLAB_EMPTY && c->empty) {
+        buddy_free(s);
+        return;
+    }
+    slab_link(c, s, bucket);
+}
+
+// An object from the fullest partial slab, so that lightly used slabs
+// drain and can be given back. Caller holds c->lock.
+void* take_object(struct kcache* c) {
+    struct slab* s = 0;
+    for (int i = SLAB_BUCKETS - 1; i >= 0 && !s; i--) {
+        s = c->partial[i];
+    }
+    if (!s) {
+        s = c->empty;
+    }
+    if (!s) {
+        return 0;
+    }
+    void* obj = s->free;
+    s->free = *(void**)obj;
+    s->inuse++;
+    slab_place(c, s);
+    return obj;
+}
+
+// Caller holds c->lock.
+void put_object(struct kcache* c, void* obj) {
+    struct slab* s = (struct slab*)PGROUNDDOWN((uint64)obj);
+    *(void**)obj = s->free;
+    s->free = obj;
+    s->inuse--;
+    slab_place(c, s);
+}
+
+// Adds a fresh slab. Called without any slab lock held: buddy_alloc()
+// may call slab_reclaim() when it runs out of memory.
+int slab_grow(struct kcache* c) {
+    struct slab* s = buddy_alloc(1);
+    if (s == 0) {
+        return 0;
+    }
+    s->cache = c;
+    s->inuse = 0;
+    s->free = 0;
+    char* first = (char*)s + SLAB_ALIGN;
+    for (int i = c->per_slab - 1; i >= 0; i--) {
+        void* obj = first + i * c->size;
+        *(void**)obj = s->free;
+        s->free = obj;
+    }
+
+    acquire(&c->lock);
+    slab_link(c, s, SLAB_EMPTY);
+    release(&c->lock);
+    return 1;
+}
+
+void* slab_alloc(enum kobj type) {
+    struct kcache* c = &caches[type];
+    for (;;) {
+        push_off();
+        int id = cpuid();
+        acquire(&cpu_objs[id][type].lock);
+        if (cpu_objs[id][type].count == 0) {
+            acquire(&c->lock);
+            void* obj;
+            while (cpu_objs[id][type].count < CPU_BATCH && (obj = take_object(c)) != 0) {
+                cpu_objs[id][type].objs[cpu_objs[id][type].count++] = obj;
+            }
+            release(&c->lock);
+        }
+        void* obj = 0;
+        if (cpu_objs[id][type].count > 0) {
+            obj = cpu_objs[id][type].objs[--cpu_objs[id][type].count];
+        }
+        release(&cpu_objs[id][type].lock);
+        pop_off();
+
+        if (obj) {
+            return obj;
+        }
+        if (!slab_grow(c)) {
+            return 0;
+        }
+    }
+}
+
+void slab_free(void* obj) {
+    struct slab* s = (struct slab*)PGROUNDDOWN((uint64)obj);
+    if (obj == 0 || (char*)obj < (char*)s + SLAB_ALIGN ||
+        s->cache < caches || s->cache >= caches + NKOBJ) {
+        panic("slab_free");
+    }
+    struct kcache* c = s->cache;
+    int type = c - caches;
+
+    push_off();
+    int id = cpuid();
+    acquire(&cpu_objs[id][type].lock);
+    if (cpu_objs[id][type].count == CPU_OBJS) {
+        acquire(&c->lock);
+        for (int i = 0; i < CPU_BATCH; i++) {
+            put_object(c, cpu_objs[id][type].objs[--cpu_objs[id][type].count]);
+        }
+        release(&c->lock);
+    }
+    cpu_objs[id][type].objs[cpu_objs[id][type].count++] = obj;
+    release(&cpu_objs[id][type].lock);
+    pop_off();
+}
+
+// Returns every cached object to its slab and every empty slab to the
+// buddy allocator. Called by buddy_alloc() before it gives up.
+void slab_reclaim() {
+    for (int type = 0; type < NKOBJ; type++) {
+        struct kcache* c = &caches[type];
+        for (int i = 0; i < NCPU; i++) {
+            acquire(&cpu_objs[i][type].lock);
+            acquire(&c->lock);
+            while (cpu_objs[i][type].count > 0) {
+                put_object(c, cpu_objs[i][type].objs[--cpu_objs[i][type].count]);
+            }
+            release(&c->lock);
+            release(&cpu_objs[i][type].lock);
+        }
+
+        acquire(&c->lock);
+        while (c->empty) {
+            struct slab* s = c->empty;
+            slab_unlink(c, s);
+            buddy_free(s);
+        }
+        release(&c->lock);
+    }
+}
@@ -5,5 +5,9 @@ struct spinlock {
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
+
+  // For statistics, updated while the lock is held:
+  uint64 nacquire;   // Number of acquire() calls.
+  uint64 ncontended; // Acquires that had to spin.
 };
 
@@ -109,6 +109,9 @@ extern uint64 sys_unlink(void);
 extern uint64 sys_link(void);
 extern uint64 sys_mkdir(void);
 extern uint64 sys_close(void);
+extern uint64 sys_memstat(void);
+extern uint64 sys_allocbench(void);
+extern uint64 sys_allocsites(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -135,6 +138,9 @@ static uint64 (*syscalls[])(void) = {
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
 [SYS_poweroff]   sys_poweroff,
+[SYS_memstat] sys_memstat,
+[SYS_allocbench] sys_allocbench,
+[SYS_allocsites] sys_allocsites,
 };
 
 void
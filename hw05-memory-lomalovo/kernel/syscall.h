@@ -21,3 +21,6 @@
 #define SYS_mkdir  20
 #define SYS_close  21
 #define SYS_poweroff  22
+#define SYS_memstat 23
+#define SYS_allocbench 24
+#define SYS_allocsites 25
@@ -341,6 +341,13 @@ sys_open(void)
     return -1;
   }
 
+  // a running program pages itself in from the file
+  if((omode & O_TRUNC) && ip->type == T_FILE && ip->text){
+    iunlockput(ip);
+    end_op();
+    return -1;
+  }
+
   if((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0){
     if(f)
       fileclose(f);
@@ -5,6 +5,8 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "memstat.h"
+#include "allocbench.h"
 
 uint64
 sys_exit(void)
@@ -89,3 +91,61 @@ sys_uptime(void)
   release(&tickslock);
   return xticks;
 }
+
+// Copy the physical memory allocator's statistics
+// to the struct buddy_stats at the user address.
+uint64
+sys_memstat(void)
+{
+  uint64 addr;
+  struct buddy_stats st;
+
+  argaddr(0, &addr);
+  buddy_stat(&st);
+  if(copyout(myproc()->pagetable, addr, (char*)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
+
+// Run the allocator benchmark described by the struct
+// allocbench at the user address and copy the results back.
+uint64
+sys_allocbench(void)
+{
+  uint64 addr;
+  struct allocbench b;
+
+  argaddr(0, &addr);
+  if(copyin(myproc()->pagetable, (char*)&b, addr, sizeof(b)) < 0)
+    return -1;
+  if(allocbench(&b) < 0)
+    return -1;
+  if(copyout(myproc()->pagetable, addr, (char*)&b, sizeof(b)) < 0)
+    return -1;
+  return 0;
+}
+
+// Copy up to n entries describing the live allocations by call
+// site to the user address; returns how many there are, or -1 if
+// the kernel was built without ALLOCTRACK.
+uint64
+sys_allocsites(void)
+{
+  uint64 addr;
+  int n;
+  struct alloc_site *sites;
+
+  argaddr(0, &addr);
+  argint(1, &n);
+  if(n < 0)
+    return -1;
+  if(n > PGSIZE / sizeof(struct alloc_site))
+    n = PGSIZE / sizeof(struct alloc_site);
+  if((sites = kalloc()) == 0)
+    return -1;
+  n = buddy_sites(sites, n);
+  if(n > 0 && copyout(myproc()->pagetable, addr, (char*)sites, n * sizeof(struct alloc_site)) < 0)
+    n = -1;
+  kfree(sites);
+  return n;
+}
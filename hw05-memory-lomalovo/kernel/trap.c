@@ -29,6 +29,21 @@ trapinithart(void)
   w_stvec((uint64)kernelvec);
 }
 
+// A page fault at va: a store to a copy-on-write page, or the
+// first access to a program or heap page. Reading a program page
+// in may sleep, so interrupts go on as for a system call.
+// Returns 0 if the faulting instruction can run again.
+static int
+pagefault(struct proc *p, uint64 scause, uint64 va)
+{
+  if(scause != 12 && scause != 13 && scause != 15)
+    return -1;
+  intr_on();
+  if(scause == 15 && uvmcow(p->pagetable, va) == 0)
+    return 0;
+  return uvmfault(p, va);
+}
+
 //
 // handle an interrupt, exception, or system call from user space.
 // called from trampoline.S
@@ -68,9 +83,13 @@ usertrap(void)
   } else if((which_dev = devintr()) != 0){
     // ok
   } else {
-    printf("usertrap(): unexpected scause %p pid=%d\n", r_scause(), p->pid);
-    printf("            sepc=%p stval=%p\n", r_sepc(), r_stval());
-    setkilled(p);
+    uint64 scause = r_scause();
+    uint64 stval = r_stval();
+    if(pagefault(p, scause, stval) < 0){
+      printf("usertrap(): unexpected scause %p pid=%d\n", scause, p->pid);
+      printf("            sepc=%p stval=%p\n", p->trapframe->epc, stval);
+      setkilled(p);
+    }
   }
 
   if(killed(p))
@@ -122,11 +141,15 @@ usertrapret(void)
   // tell trampoline.S the user page table to switch to.
   uint64 satp = MAKE_SATP(p->pagetable);
 
+  // where the trapframe is in user space: the trapframe page is mapped
+  // at TRAPFRAME, the trapframe is somewhere inside it.
+  uint64 trapframe = TRAPFRAME + ((uint64)p->trapframe & (PGSIZE - 1));
+
   // jump to userret in trampoline.S at the top of memory, which 
   // switches to the user page table, restores user registers,
   // and switches to user mode with sret.
   uint64 trampoline_userret = TRAMPOLINE + (userret - trampoline);
-  ((void (*)(uint64))trampoline_userret)(satp);
+  ((void (*)(uint64, uint64))trampoline_userret)(satp, trapframe);
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -151,8 +174,11 @@ kerneltrap()
   }
 
   // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING)
+  if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING){
+    myproc()->kpreempted = 1;
     yield();
+    myproc()->kpreempted = 0;
+  }
 
   // the yield() may have caused some traps to occur,
   // so restore trap registers for use by kernelvec.S's sepc instruction.
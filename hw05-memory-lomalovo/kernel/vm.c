@@ -5,6 +5,8 @@
 #include "riscv.h"
 #include "defs.h"
 #include "fs.h"
+#include "spinlock.h"
+#include "proc.h"
 
 /*
  * the kernel's page table.
@@ -40,6 +42,7 @@ kvmmake(void)
   kvmmap(kpgtbl, KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X);
 
   // map kernel data and the physical RAM we'll make use of.
+  // mappages() uses megapages from the first 2 MB boundary on.
   kvmmap(kpgtbl, (uint64)etext, (uint64)etext, PHYSTOP-(uint64)etext, PTE_R | PTE_W);
 
   // map the trampoline for trap entry/exit to
@@ -73,6 +76,29 @@ kvminithart()
   sfence_vma();
 }
 
+// walk() down to the PTE for va at the given level, or to the
+// leaf above it that maps va.
+static pte_t *
+walkto(pagetable_t pagetable, uint64 va, int level, int alloc)
+{
+  if(va >= MAXVA)
+    panic("walk");
+
+  for(int l = 2; l > level; l--) {
+    pte_t *pte = &pagetable[PX(l, va)];
+    if(*pte & PTE_V) {
+      if(*pte & (PTE_R|PTE_W|PTE_X))
+        return pte;
+      pagetable = (pagetable_t)PTE2PA(*pte);
+    } else {
+      if(!alloc || (pagetable = (pde_t*)kzalloc()) == 0)
+        return 0;
+      *pte = PA2PTE(pagetable) | PTE_V;
+    }
+  }
+  return &pagetable[PX(level, va)];
+}
+
 // Return the address of the PTE in page table pagetable
 // that corresponds to virtual address va.  If alloc!=0,
 // create any required page-table pages.
@@ -85,24 +111,24 @@ kvminithart()
 //   21..29 -- 9 bits of level-1 index.
 //   12..20 -- 9 bits of level-0 index.
 //    0..11 -- 12 bits of byte offset within the page.
+// A leaf PTE at level 1 maps a 2 MB megapage; if va is in
+// one, that PTE is returned.
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
 {
-  if(va >= MAXVA)
-    panic("walk");
+  return walkto(pagetable, va, 0, alloc);
+}
 
-  for(int level = 2; level > 0; level--) {
-    pte_t *pte = &pagetable[PX(level, va)];
-    if(*pte & PTE_V) {
-      pagetable = (pagetable_t)PTE2PA(*pte);
-    } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
-        return 0;
-      memset(pagetable, 0, PGSIZE);
-      *pte = PA2PTE(pagetable) | PTE_V;
-    }
-  }
-  return &pagetable[PX(0, va)];
+// The PTE of the megapage that maps va, or 0 if va is not
+// in one.
+static pte_t *
+megapte(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte = walkto(pagetable, va, 1, 0);
+
+  if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & (PTE_R|PTE_W|PTE_X)) == 0)
+    return 0;
+  return pte;
 }
 
 // Look up a virtual address, return the physical address,
@@ -112,19 +138,22 @@ uint64
 walkaddr(pagetable_t pagetable, uint64 va)
 {
   pte_t *pte;
-  uint64 pa;
+  uint64 pa, off = 0;
 
   if(va >= MAXVA)
     return 0;
 
-  pte = walk(pagetable, va, 0);
+  if((pte = megapte(pagetable, va)) != 0)
+    off = PGROUNDDOWN(va) & (MEGAPGSIZE - 1);
+  else
+    pte = walk(pagetable, va, 0);
   if(pte == 0)
     return 0;
   if((*pte & PTE_V) == 0)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
-  pa = PTE2PA(*pte);
+  pa = PTE2PA(*pte) + off;
   return pa;
 }
 
@@ -142,10 +171,12 @@ kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
 // physical addresses starting at pa. va and size might not
 // be page-aligned. Returns 0 on success, -1 if walk() couldn't
 // allocate a needed page-table page.
+// Each 2 MB of the range where va and pa are both 2 MB aligned
+// gets a megapage, unless a page table already covers it.
 int
 mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 {
-  uint64 a, last;
+  uint64 a, last, step;
   pte_t *pte;
 
   if(size == 0)
@@ -154,41 +185,168 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   a = PGROUNDDOWN(va);
   last = PGROUNDDOWN(va + size - 1);
   for(;;){
-    if((pte = walk(pagetable, a, 1)) == 0)
-      return -1;
-    if(*pte & PTE_V)
-      panic("mappages: remap");
+    if(a % MEGAPGSIZE == 0 && pa % MEGAPGSIZE == 0 &&
+       last - a >= MEGAPGSIZE - PGSIZE &&
+       (pte = walkto(pagetable, a, 1, 1)) != 0 && (*pte & PTE_V) == 0){
+      step = MEGAPGSIZE;
+    } else {
+      if((pte = walk(pagetable, a, 1)) == 0)
+        return -1;
+      if(*pte & PTE_V)
+        panic("mappages: remap");
+      step = PGSIZE;
+    }
     *pte = PA2PTE(pa) | perm | PTE_V;
-    if(a == last)
+    if(last - a < step)
       break;
-    a += PGSIZE;
-    pa += PGSIZE;
+    a += step;
+    pa += step;
   }
   return 0;
 }
 
+// Split the megapage at *pte into 512 pages of the same memory
+// and permissions, under a new level-0 page table. Returns 0,
+// or -1 if there is no memory for the page table.
+static int
+demote(pte_t *pte)
+{
+  pagetable_t pt;
+  uint64 pa = PTE2PA(*pte);
+
+  if((pt = (pagetable_t)kalloc()) == 0)
+    return -1;
+  for(int i = 0; i < 512; i++)
+    pt[i] = PA2PTE(pa + i*PGSIZE) | PTE_FLAGS(*pte);
+  *pte = PA2PTE(pt) | PTE_V;
+  return 0;
+}
+
+// Make sure no megapage spans va, so that the memory below
+// and above it can be unmapped apart. Returns 0, or -1 if there
+// is no memory to split one.
+int
+uvmdemote(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+
+  if(va % MEGAPGSIZE == 0 || va >= MAXVA || (pte = megapte(pagetable, va)) == 0)
+    return 0;
+  return demote(pte);
+}
+
+// Is the whole buddy block starting at pa mapped at va..va+n pages,
+// in order, in pagetable, and nowhere else?
+static int
+mapped_block(pagetable_t pagetable, uint64 va, uint64 pa, int n)
+{
+  pte_t *pte;
+
+  for(int i = 0; i < n; i++){
+    if((pte = walk(pagetable, va + i*PGSIZE, 0)) == 0 ||
+       (*pte & PTE_V) == 0 || PTE2PA(*pte) != pa + i*PGSIZE ||
+       buddy_shared((void*)(pa + i*PGSIZE)))
+      return 0;
+  }
+  return 1;
+}
+
+// Map the n-page buddy block mem at va, or free it and return -1
+// if mappages() runs out of page-table pages.
+static int
+mapblock(pagetable_t pagetable, uint64 va, char *mem, int n, int perm)
+{
+  if(mappages(pagetable, va, n*PGSIZE, (uint64)mem, perm) == 0)
+    return 0;
+  // mappages may have mapped a prefix before running out of
+  // page-table pages
+  for(int i = 0; i < n; i++){
+    pte_t *pte = walk(pagetable, va + i*PGSIZE, 0);
+    if(pte && (*pte & PTE_V))
+      *pte = 0;
+  }
+  buddy_free(mem);
+  return -1;
+}
+
+// Are none of the n pages at va mapped?
+static int
+unmapped(pagetable_t pagetable, uint64 va, int n)
+{
+  pte_t *pte;
+
+  for(int i = 0; i < n; i++){
+    if((pte = walk(pagetable, va + i*PGSIZE, 0)) != 0 && (*pte & PTE_V))
+      return 0;
+  }
+  return 1;
+}
+
+// Free the 512 pages of a megapage at pa that is being unmapped,
+// in one buddy_free() if it is a buddy block of its own.
+static void
+freemega(uint64 pa)
+{
+  int shared = 0;
+
+  for(int i = 0; i < 512; i++)
+    shared |= buddy_shared((void*)(pa + i*PGSIZE));
+  if(!shared && buddy_block_pages((void*)pa) == 512){
+    buddy_free((void*)pa);
+    return;
+  }
+  for(int i = 0; i < 512; i++){
+    if(!buddy_unshare((void*)(pa + i*PGSIZE)))
+      buddy_free_page((void*)(pa + i*PGSIZE));
+  }
+}
+
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
-// Optionally free the physical memory.
+// page-aligned. Pages that were never mapped, such as heap
+// memory no one touched, are skipped.
+// Optionally free the physical memory: a buddy block that
+// uvmalloc mapped whole and that lies entirely in the range
+// goes back in one buddy_free(), other pages one at a time.
+// Pages still shared copy-on-write with other processes are
+// left to them. A megapage that is only partly in the range
+// is split first; growproc() splits the one at the end of the
+// heap beforehand, so that this cannot fail there.
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
   uint64 a;
   pte_t *pte;
+  uint64 block_end = 0;   // pages below this belong to a block being freed
 
   if((va % PGSIZE) != 0)
     panic("uvmunmap: not aligned");
 
   for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
-    if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
-    if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
+    if((pte = megapte(pagetable, a)) != 0){
+      if(a % MEGAPGSIZE == 0 && a + MEGAPGSIZE <= va + npages*PGSIZE){
+        if(do_free)
+          freemega(PTE2PA(*pte));
+        *pte = 0;
+        a += MEGAPGSIZE - PGSIZE;
+        continue;
+      }
+      if(demote(pte) < 0)
+        panic("uvmunmap: demote");
+    }
+    if((pte = walk(pagetable, a, 0)) == 0 || (*pte & PTE_V) == 0)
+      continue;
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
-    if(do_free){
+    if(do_free && a >= block_end){
       uint64 pa = PTE2PA(*pte);
-      kfree((void*)pa);
+      int n = buddy_block_pages((void*)pa);
+      if(n > 1 && a + n*PGSIZE <= va + npages*PGSIZE &&
+         mapped_block(pagetable, a, pa, n)){
+        block_end = a + n*PGSIZE;
+        buddy_free((void*)pa);
+      } else if(!buddy_unshare((void*)pa)){
+        buddy_free_page((void*)pa);
+      }
     }
     *pte = 0;
   }
@@ -200,10 +358,9 @@ pagetable_t
 uvmcreate()
 {
   pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
+  pagetable = (pagetable_t) kzalloc();
   if(pagetable == 0)
     return 0;
-  memset(pagetable, 0, PGSIZE);
   return pagetable;
 }
 
@@ -217,33 +374,45 @@ uvmfirst(pagetable_t pagetable, uchar *src, uint sz)
 
   if(sz >= PGSIZE)
     panic("uvmfirst: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = buddy_alloc_zeroed(1, MIGRATE_MOVABLE);
   mappages(pagetable, 0, PGSIZE, (uint64)mem, PTE_W|PTE_R|PTE_X|PTE_U);
   memmove(mem, src, sz);
 }
 
 // Allocate PTEs and physical memory to grow process from oldsz to
 // newsz, which need not be page aligned.  Returns new size or 0 on error.
+// Memory comes in the biggest buddy blocks that fit, up to
+// UVM_BLOCK pages, each mapped with one mappages() at an address
+// aligned to its size, so that a 512-page block is a megapage.
+// The block sizes need no bookkeeping: the buddy allocator's own
+// record of them lets uvmunmap give whole blocks back.
+#define UVM_BLOCK 512
+
 uint64
 uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
 {
   char *mem;
   uint64 a;
+  int n;
 
   if(newsz < oldsz)
     return oldsz;
 
   oldsz = PGROUNDUP(oldsz);
-  for(a = oldsz; a < newsz; a += PGSIZE){
-    mem = kalloc();
-    if(mem == 0){
-      uvmdealloc(pagetable, a, oldsz);
-      return 0;
+  for(a = oldsz; a < newsz; a += n*PGSIZE){
+    n = UVM_BLOCK;
+    while(n > 1 && (a + n*PGSIZE > PGROUNDUP(newsz) || a % (n*PGSIZE) != 0))
+      n /= 2;
+    // compaction may make a big block, and a smaller one may
+    // still be there when a big one is not
+    mem = buddy_alloc_zeroed(n, MIGRATE_MOVABLE);
+    if(mem == 0 && n > 1 && (mem = buddy_compact(n)) != 0)
+      memset(mem, 0, n*PGSIZE);
+    while(mem == 0 && n > 1){
+      n /= 2;
+      mem = buddy_alloc_zeroed(n, MIGRATE_MOVABLE);
     }
-    memset(mem, 0, PGSIZE);
-    if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_R|PTE_U|xperm) != 0){
-      kfree(mem);
+    if(mem == 0 || mapblock(pagetable, a, mem, n, PTE_R|PTE_U|xperm) != 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
@@ -251,6 +420,102 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
   return newsz;
 }
 
+// Map demand-zero memory at the unmapped page va of the heap,
+// which spans [lo, sz): sbrk() only moves sz, and the first
+// access to each page lands here, through uvmfault(). The
+// biggest aligned block of up to LAZY_BLOCK pages around va that
+// is all unmapped and in the heap is mapped at once, so that a
+// program working through its heap faults once per block.
+// Where the whole 2 MB around va is heap and has no page table
+// yet, it gets a megapage instead, if a 512-page block is free or
+// compaction can make one; compaction only runs when the caller
+// holds no spinlock (interrupts are on), as buddy_compact() needs.
+// Returns 0, or -1 if va is not in the heap or memory ran out.
+#define LAZY_BLOCK 16
+
+static int
+uvmlazy(pagetable_t pagetable, uint64 va, uint64 lo, uint64 sz)
+{
+  uint64 base;
+  char *mem;
+  pte_t *pte;
+
+  if(va < lo || va >= sz)
+    return -1;
+  va = PGROUNDDOWN(va);
+  base = va & ~(uint64)(MEGAPGSIZE - 1);
+  if(base >= lo && base + MEGAPGSIZE <= PGROUNDUP(sz) &&
+     ((pte = walkto(pagetable, base, 1, 0)) == 0 || (*pte & PTE_V) == 0)){
+    mem = buddy_alloc_zeroed(512, MIGRATE_MOVABLE);
+    if(mem == 0 && intr_get() && (mem = buddy_compact(512)) != 0)
+      memset(mem, 0, MEGAPGSIZE);
+    if(mem != 0)
+      return mapblock(pagetable, base, mem, 512, PTE_R|PTE_W|PTE_U);
+  }
+  for(int n = LAZY_BLOCK; n > 0; n /= 2){
+    base = va & ~((uint64)n*PGSIZE - 1);
+    if(base < lo || base + n*PGSIZE > PGROUNDUP(sz) ||
+       !unmapped(pagetable, base, n))
+      continue;
+    if((mem = buddy_alloc_zeroed(n, MIGRATE_MOVABLE)) != 0)
+      return mapblock(pagetable, base, mem, n, PTE_R|PTE_W|PTE_U);
+  }
+  return -1;
+}
+
+// Map the page at va of process p on its first use, after a
+// page fault there or before copyin()/copyout() touch it:
+// program pages are read from the file by loadfault(), heap
+// pages above them are zeroed by uvmlazy(). Returns 0, or -1 if
+// va is neither or the page could not be filled.
+int
+uvmfault(struct proc *p, uint64 va)
+{
+  struct vmseg *s;
+  uint64 lo = 0;
+
+  if(va >= p->sz || va >= MAXVA || !unmapped(p->pagetable, PGROUNDDOWN(va), 1))
+    return -1;
+  for(s = p->seg; s < &p->seg[NSEG]; s++){
+    if(s->ip == 0)
+      continue;
+    if(va >= s->va && va < s->va + s->memsz)
+      return loadfault(p->pagetable, s, va);
+    if(s->va + s->memsz > lo)
+      lo = s->va + s->memsz;
+  }
+  return uvmlazy(p->pagetable, va, PGROUNDUP(lo), p->sz);
+}
+
+// Read in what is not loaded yet of the program pages in
+// [va, va+len) of the current process, for code that is about to
+// copy to or from there holding a spinlock or a buffer, where
+// loadfault() cannot go to the disk. Heap pages are left to the
+// copy: uvmlazy() does not sleep. Pages that cannot be loaded are
+// left for the copy to fail on.
+void
+uvmprefault(uint64 va, uint64 len)
+{
+  struct proc *p = myproc();
+  struct vmseg *s;
+  uint64 lo, hi;
+
+  if(va >= p->sz)
+    return;
+  if(len > p->sz - va)
+    len = p->sz - va;
+  for(s = p->seg; s < &p->seg[NSEG]; s++){
+    if(s->ip == 0)
+      continue;
+    lo = va > s->va ? va : s->va;
+    hi = va + len < s->va + s->memsz ? va + len : s->va + s->memsz;
+    for(uint64 a = PGROUNDDOWN(lo); a < hi; a += PGSIZE){
+      if(walkaddr(p->pagetable, a) == 0)
+        uvmfault(p, a);
+    }
+  }
+}
+
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
@@ -269,6 +534,51 @@ uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
   return newsz;
 }
 
+// uvmmigrate() for a page table at the given level.
+static void
+migrate(pagetable_t pagetable, int level, uint64 lo, uint64 hi)
+{
+  // there are 2^9 = 512 PTEs in a page table.
+  for(int i = 0; i < 512; i++){
+    pte_t *pte = &pagetable[i];
+    if((*pte & PTE_V) == 0)
+      continue;
+    if((*pte & (PTE_R|PTE_W|PTE_X)) == 0){
+      // this PTE points to a lower-level page table.
+      migrate((pagetable_t)PTE2PA(*pte), level - 1, lo, hi);
+      continue;
+    }
+    uint64 pa = PTE2PA(*pte);
+    // other page tables map a shared page too
+    if(level > 0 || (*pte & PTE_U) == 0 || pa < lo || pa >= hi ||
+       buddy_shared((void*)pa))
+      continue;
+    char *mem = buddy_alloc_type(1, MIGRATE_MOVABLE);
+    if(mem == 0)
+      return;
+    if((uint64)mem >= lo && (uint64)mem < hi){
+      // freed into the region since the pass began
+      buddy_free(mem);
+      return;
+    }
+    memmove(mem, (char*)pa, PGSIZE);
+    *pte = PA2PTE(mem) | PTE_FLAGS(*pte);
+    buddy_capture((void*)pa);
+  }
+}
+
+// Move the user pages of pagetable that lie in physical memory
+// [lo, hi) to newly allocated pages, for buddy_compact(), which
+// gets the old pages through buddy_capture(). Stops early if it
+// cannot get a page outside [lo, hi). The owning process must not
+// be running nor hold the physical address of any of its pages.
+// Megapages stay where they are.
+void
+uvmmigrate(pagetable_t pagetable, uint64 lo, uint64 hi)
+{
+  migrate(pagetable, 2, lo, hi);
+}
+
 // Recursively free page-table pages.
 // All leaf mappings must already have been removed.
 void
@@ -299,10 +609,12 @@ uvmfree(pagetable_t pagetable, uint64 sz)
   freewalk(pagetable);
 }
 
-// Given a parent process's page table, copy
-// its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// Given a parent process's page table, share
+// its memory with a child's page table.
+// Copies the page table but not the physical
+// memory: writable pages become read-only
+// and copy-on-write in both, and uvmcow()
+// copies one when either process writes it.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
@@ -311,20 +623,35 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
   pte_t *pte;
   uint64 pa, i;
   uint flags;
-  char *mem;
 
   for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
-    if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
+    if((pte = megapte(old, i)) != 0){
+      // i is the start of the megapage; the child gets one too
+      if(*pte & PTE_W)
+        *pte = (*pte & ~PTE_W) | PTE_COW;
+      pa = PTE2PA(*pte);
+      for(int j = 0; j < 512; j++)
+        buddy_share((void*)(pa + j*PGSIZE));
+      if(mappages(new, i, MEGAPGSIZE, pa, PTE_FLAGS(*pte)) != 0){
+        for(int j = 0; j < 512; j++)
+          buddy_unshare((void*)(pa + j*PGSIZE));
+        goto err;
+      }
+      i += MEGAPGSIZE - PGSIZE;
+      continue;
+    }
+    // heap memory not touched yet stays demand-zero in both
+    if((pte = walk(old, i, 0)) == 0 || (*pte & PTE_V) == 0)
+      continue;
     pa = PTE2PA(*pte);
+    if(*pte & PTE_W)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-      kfree(mem);
+    // shared before the child maps it, so that compaction
+    // never moves it from under one of the two
+    buddy_share((void*)pa);
+    if(mappages(new, i, PGSIZE, pa, flags) != 0){
+      buddy_unshare((void*)pa);
       goto err;
     }
   }
@@ -335,6 +662,57 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
   return -1;
 }
 
+// Give pagetable a writable page of its own at va, which must
+// be copy-on-write: after a store page fault there, or before
+// copyout() writes there. The shared page is reused if no other
+// process maps it any more. Returns 0, or -1 if va is not a
+// copy-on-write page or memory ran out.
+// A copy-on-write megapage stays whole if no one else maps any
+// of it any more; otherwise it is split and only the page at va
+// is copied.
+int
+uvmcow(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  uint64 pa;
+  char *mem;
+  int i;
+
+  if(va >= MAXVA)
+    return -1;
+  if((pte = megapte(pagetable, va)) != 0){
+    if((*pte & (PTE_U|PTE_COW)) != (PTE_U|PTE_COW))
+      return -1;
+    pa = PTE2PA(*pte);
+    for(i = 0; i < 512; i++)
+      if(buddy_shared((void*)(pa + i*PGSIZE)))
+        break;
+    if(i == 512){
+      *pte = (*pte | PTE_W) & ~PTE_COW;
+      return 0;
+    }
+    if(demote(pte) < 0)
+      return -1;
+  }
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & (PTE_V|PTE_U|PTE_COW)) != (PTE_V|PTE_U|PTE_COW))
+    return -1;
+  pa = PTE2PA(*pte);
+  if(buddy_shared((void*)pa)){
+    if((mem = buddy_alloc_type(1, MIGRATE_MOVABLE)) == 0)
+      return -1;
+    memmove(mem, (char*)pa, PGSIZE);
+    if(buddy_unshare((void*)pa)){
+      *pte = PA2PTE(mem) | ((PTE_FLAGS(*pte) | PTE_W) & ~PTE_COW);
+      return 0;
+    }
+    // the others unmapped it meanwhile
+    buddy_free(mem);
+  }
+  *pte = (*pte | PTE_W) & ~PTE_COW;
+  return 0;
+}
+
 // mark a PTE invalid for user access.
 // used by exec for the user stack guard page.
 void
@@ -348,6 +726,21 @@ uvmclear(pagetable_t pagetable, uint64 va)
   *pte &= ~PTE_U;
 }
 
+// Look up user page va0 like walkaddr(), but map it first if it
+// is a program or heap page of the current process not used yet.
+static uint64
+useraddr(pagetable_t pagetable, uint64 va0)
+{
+  struct proc *p = myproc();
+  uint64 pa0;
+
+  pa0 = walkaddr(pagetable, va0);
+  if(pa0 == 0 && p != 0 && p->pagetable == pagetable &&
+     uvmfault(p, va0) == 0)
+    pa0 = walkaddr(pagetable, va0);
+  return pa0;
+}
+
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
 // Return 0 on success, -1 on error.
@@ -355,10 +748,17 @@ int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
+  pte_t *pte;
 
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
+    if(va0 >= MAXVA)
+      return -1;
+    // a page shared copy-on-write needs a copy first
+    pte = walk(pagetable, va0, 0);
+    if(pte && (*pte & PTE_COW) && uvmcow(pagetable, va0) < 0)
+      return -1;
+    pa0 = useraddr(pagetable, va0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (dstva - va0);
@@ -383,7 +783,7 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = useraddr(pagetable, va0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -410,7 +810,7 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = useraddr(pagetable, va0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -0,0 +1,122 @@
+// Allocator microbenchmarks: runs allocbench() in nproc processes at
+// once for a table of allocators and patterns and prints the cost per
+// operation (alloc or free) and the total throughput. Fails if any run
+// saw a block change while it was held.
+//
+// usage: allocbench [nproc [ops [batch]]]
+// Times come from r_time(), whose timebase is 10 MHz on qemu's virt
+// machine; ns/op averages over the processes, ops/ms counts them all.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/allocbench.h"
+#include "user/user.h"
+
+#define NS_PER_TICK 100
+
+char *patterns[] = { "lifo", "fifo", "random", "producer", "consumer" };
+char *allocators[] = { "buddy", "kalloc", "slab" };
+
+void
+child(int fd, struct allocbench *b)
+{
+  if(allocbench(b) < 0){
+    printf("allocbench: allocbench failed\n");
+    exit(1);
+  }
+  write(fd, b, sizeof(*b));
+  exit(0);
+}
+
+// Runs nproc copies of the benchmark at once; with pattern
+// BENCH_PRODUCER, half of them are consumers.
+int
+run(int allocator, int pattern, int order, int nproc, int ops, int batch)
+{
+  int fds[2];
+  uint64 time = 0, maxtime = 0;
+  int allocs = 0, frees = 0, failed = 0, corrupt = 0;
+
+  if(pipe(fds) < 0){
+    printf("allocbench: pipe failed\n");
+    exit(1);
+  }
+  for(int i = 0; i < nproc; i++){
+    struct allocbench b;
+    b.allocator = allocator;
+    b.pattern = pattern;
+    if(pattern == BENCH_PRODUCER && i % 2 == 1)
+      b.pattern = BENCH_CONSUMER;
+    b.order = order;
+    b.ops = ops;
+    b.batch = batch;
+    int pid = fork();
+    if(pid < 0){
+      printf("allocbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      close(fds[0]);
+      child(fds[1], &b);
+    }
+  }
+  close(fds[1]);
+  for(int i = 0; i < nproc; i++){
+    struct allocbench b;
+    if(read(fds[0], &b, sizeof(b)) != sizeof(b)){
+      printf("allocbench: lost a result\n");
+      exit(1);
+    }
+    time += b.time;
+    if(b.time > maxtime)
+      maxtime = b.time;
+    allocs += b.allocs;
+    frees += b.frees;
+    failed += b.failed;
+    corrupt += b.corrupt;
+  }
+  close(fds[0]);
+  for(int i = 0; i < nproc; i++)
+    wait(0);
+
+  int n = allocs + frees;
+  printf("%s order %d %s x%d: ", allocators[allocator], order, patterns[pattern], nproc);
+  if(n > 0 && maxtime > 0)
+    printf("%l ns/op, %l ops/ms", time * NS_PER_TICK / n,
+           (uint64)n * 1000000 / (maxtime * NS_PER_TICK));
+  printf(", %d failed, %d corrupt\n", failed, corrupt);
+  return corrupt;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nproc = argc > 1 ? atoi(argv[1]) : 2;
+  int ops = argc > 2 ? atoi(argv[2]) : 20000;
+  int batch = argc > 3 ? atoi(argv[3]) : 64;
+  int corrupt = 0;
+
+  if(nproc < 1 || ops < 1 || batch < 1 || batch > BENCH_MAXBATCH){
+    printf("usage: allocbench [nproc [ops [batch]]]\n");
+    exit(1);
+  }
+
+  int orders[] = { 0, 2, 5 };
+  for(int i = 0; i < sizeof(orders)/sizeof(orders[0]); i++)
+    for(int pattern = BENCH_LIFO; pattern <= BENCH_FIFO; pattern++)
+      corrupt += run(BENCH_BUDDY, pattern, orders[i], nproc, ops, batch);
+  corrupt += run(BENCH_BUDDY, BENCH_RANDOM, 3, nproc, ops, batch);
+  for(int allocator = BENCH_KALLOC; allocator <= BENCH_SLAB; allocator++)
+    for(int pattern = BENCH_LIFO; pattern <= BENCH_RANDOM; pattern++)
+      corrupt += run(allocator, pattern, 0, nproc, ops, batch);
+  if(nproc >= 2){
+    for(int allocator = BENCH_BUDDY; allocator <= BENCH_SLAB; allocator++)
+      corrupt += run(allocator, BENCH_PRODUCER, 0, nproc, ops, batch);
+  }
+
+  if(corrupt){
+    printf("allocbench: FAILED, %d blocks corrupted\n", corrupt);
+    exit(1);
+  }
+  exit(0);
+}
@@ -0,0 +1,87 @@
+// Lists the live physical memory allocations by the kernel call site
+// that made them, most pages first; needs a kernel built with
+// make ALLOCTRACK=1. Look the addresses up in kernel/kernel.asm.
+//
+// usage: allocsites [interval]
+// With an interval in ticks, lists only the sites whose page count
+// changed over it, with the change: memory that is allocated over and
+// over and never given back shows up as steady growth.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/riscv.h"
+#include "kernel/memstat.h"
+#include "user/user.h"
+
+#define NSITES (PGSIZE / sizeof(struct alloc_site))
+
+// too big for the stack
+struct alloc_site before[NSITES], after[NSITES];
+
+int
+snapshot(struct alloc_site *sites)
+{
+  int n = allocsites(sites, NSITES);
+  if(n < 0){
+    printf("allocsites: allocsites failed; is the kernel built with ALLOCTRACK?\n");
+    exit(1);
+  }
+  return n;
+}
+
+// Pages that site pc held in sites[0..n), 0 if it held none.
+uint64
+held(struct alloc_site *sites, int n, uint64 pc)
+{
+  for(int i = 0; i < n; i++)
+    if(sites[i].pc == pc)
+      return sites[i].pages;
+  return 0;
+}
+
+void
+sort(struct alloc_site *sites, int n)
+{
+  for(int i = 1; i < n; i++){
+    struct alloc_site s = sites[i];
+    int j = i;
+    for(; j > 0 && sites[j-1].pages < s.pages; j--)
+      sites[j] = sites[j-1];
+    sites[j] = s;
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int interval = argc > 1 ? atoi(argv[1]) : 0;
+
+  if(argc > 2 || interval < 0){
+    printf("usage: allocsites [interval]\n");
+    exit(1);
+  }
+
+  if(interval == 0){
+    int n = snapshot(after);
+    sort(after, n);
+    for(int i = 0; i < n; i++)
+      printf("%p: %l pages in %l blocks\n", after[i].pc, after[i].pages, after[i].blocks);
+    exit(0);
+  }
+
+  int nbefore = snapshot(before);
+  sleep(interval);
+  int nafter = snapshot(after);
+  sort(after, nafter);
+  for(int i = 0; i < nafter; i++){
+    uint64 old = held(before, nbefore, after[i].pc);
+    if(after[i].pages > old)
+      printf("%p: +%l pages, %l now\n", after[i].pc, after[i].pages - old, after[i].pages);
+    else if(after[i].pages < old)
+      printf("%p: -%l pages, %l now\n", after[i].pc, old - after[i].pages, after[i].pages);
+  }
+  for(int i = 0; i < nbefore; i++)
+    if(held(after, nafter, before[i].pc) == 0)
+      printf("%p: -%l pages, 0 now\n", before[i].pc, before[i].pages);
+  exit(0);
+}
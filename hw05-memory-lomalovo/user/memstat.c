@@ -0,0 +1,74 @@
+// Samples the physical memory allocator every few ticks: free memory,
+// the largest free block, allocations, frees, lock contention and
+// compaction passes (successful/all) since the previous sample, and a
+// fragmentation index.
+//
+// usage: memstat [interval [count [order]]]
+// interval is in ticks (default 10), count 0 (the default) samples
+// until killed. The fragmentation index is the share of free memory
+// that cannot serve a request of 2^order pages (default 9, the biggest
+// block uvmalloc asks for): 0% when all free memory is in blocks that
+// big, 100% when none is.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/memstat.h"
+#include "user/user.h"
+
+int
+fragmentation(struct buddy_stats *st, int order)
+{
+  uint64 usable = 0;
+
+  if(st->free == 0)
+    return 0;
+  for(int i = order; i < MEMSTAT_ORDERS; i++)
+    usable += st->free_by_size[i] << i;
+  return (st->free - usable) * 100 / st->free;
+}
+
+int
+largest(struct buddy_stats *st)
+{
+  for(int i = MEMSTAT_ORDERS - 1; i >= 0; i--)
+    if(st->free_by_size[i] > 0)
+      return 1 << i;
+  return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int interval = argc > 1 ? atoi(argv[1]) : 10;
+  int count = argc > 2 ? atoi(argv[2]) : 0;
+  int order = argc > 3 ? atoi(argv[3]) : 9;
+  struct buddy_stats st, prev;
+
+  if(interval < 1 || count < 0 || order < 0 || order >= MEMSTAT_ORDERS){
+    printf("usage: memstat [interval [count [order]]]\n");
+    exit(1);
+  }
+
+  if(memstat(&prev) < 0){
+    printf("memstat: memstat failed\n");
+    exit(1);
+  }
+  printf("total %l pages, fragmentation for 2^%d pages\n", prev.total, order);
+  for(int n = 0; count == 0 || n < count; n++){
+    sleep(interval);
+    if(memstat(&st) < 0){
+      printf("memstat: memstat failed\n");
+      exit(1);
+    }
+    printf("free %l (cached %l zeroed %l) largest %d allocs %l frees %l contended %l/%l frag %d%% compacted %l/%l\n",
+           st.free, st.cached, st.zeroed, largest(&st),
+           st.allocs - prev.allocs, st.frees - prev.frees,
+           st.lock_contended - prev.lock_contended,
+           st.cpu_lock_contended - prev.cpu_lock_contended,
+           fragmentation(&st, order),
+           st.compact_ok - prev.compact_ok,
+           st.compact_ok + st.compact_failed - prev.compact_ok - prev.compact_failed);
+    prev = st;
+  }
+  exit(0);
+}
@@ -0,0 +1,73 @@
+// Page allocator throughput with several CPUs at once: each of
+// nproc children grows its heap by a batch of pages and shrinks it
+// back, so every round is one single-page allocation and one free
+// per page, through the per-CPU magazines. sbrk() maps memory on
+// first use, in blocks as big as fit below the break, so the heap
+// grows a page at a time and each page is touched before the next.
+//
+// usage: pagebench [nproc [rounds [pages]]]
+// Run it with CPUS=1 and CPUS=3 (or more) to see how it scales.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define PGSIZE 4096
+
+void
+worker(int rounds, int pages)
+{
+  for(int r = 0; r < rounds; r++){
+    for(int i = 0; i < pages; i++){
+      char *p = sbrk(PGSIZE);
+      if(p == (char*)-1){
+        printf("pagebench: sbrk failed\n");
+        exit(1);
+      }
+      *p = 1;
+    }
+    sbrk(-pages * PGSIZE);
+  }
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nproc = argc > 1 ? atoi(argv[1]) : 3;
+  int rounds = argc > 2 ? atoi(argv[2]) : 2000;
+  int pages = argc > 3 ? atoi(argv[3]) : 16;
+
+  if(nproc < 1 || rounds < 1 || pages < 1){
+    printf("usage: pagebench [nproc [rounds [pages]]]\n");
+    exit(1);
+  }
+
+  int start = uptime();
+  for(int i = 0; i < nproc; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("pagebench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0)
+      worker(rounds, pages);
+  }
+
+  int failed = 0;
+  for(int i = 0; i < nproc; i++){
+    int status;
+    wait(&status);
+    failed |= status;
+  }
+  int ticks = uptime() - start;
+  if(failed)
+    exit(1);
+
+  int ops = nproc * rounds * pages * 2;
+  printf("pagebench: %d procs, %d page allocs+frees in %d ticks", nproc, ops, ticks);
+  if(ticks > 0)
+    printf(", %d per tick", ops / ticks);
+  printf("\n");
+  exit(0);
+}
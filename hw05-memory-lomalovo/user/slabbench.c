@@ -0,0 +1,51 @@
+// Rates of the operations that allocate small kernel objects:
+// fork+exit+wait (one trapframe each) and pipe+close (one struct pipe).
+// Run it before and after a change to the object allocators.
+//
+// usage: slabbench [forks [pipes]]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+void
+report(char *what, int n, int ticks)
+{
+  printf("slabbench: %d %s in %d ticks", n, what, ticks);
+  if(ticks > 0)
+    printf(", %d per tick", n / ticks);
+  printf("\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  int forks = argc > 1 ? atoi(argv[1]) : 2000;
+  int pipes = argc > 2 ? atoi(argv[2]) : 20000;
+
+  int start = uptime();
+  for(int i = 0; i < forks; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("slabbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0)
+      exit(0);
+    wait(0);
+  }
+  report("fork+exit", forks, uptime() - start);
+
+  start = uptime();
+  for(int i = 0; i < pipes; i++){
+    int fds[2];
+    if(pipe(fds) < 0){
+      printf("slabbench: pipe failed\n");
+      exit(1);
+    }
+    close(fds[0]);
+    close(fds[1]);
+  }
+  report("pipe+close", pipes, uptime() - start);
+  exit(0);
+}
@@ -1,4 +1,7 @@
 struct stat;
+struct buddy_stats;
+struct allocbench;
+struct alloc_site;
 
 // system calls
 int fork(void);
@@ -23,6 +26,9 @@ char* sbrk(int);
 int sleep(int);
 int uptime(void);
 void poweroff(void);
+int memstat(struct buddy_stats*);
+int allocbench(struct allocbench*);
+int allocsites(struct alloc_site*, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -7,6 +7,8 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/memstat.h"
+#include "kernel/elf.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -2571,6 +2573,317 @@ badarg(char *s)
   exit(0);
 }
 
+// fork() shares memory copy-on-write: each process must see
+// only its own stores, including the kernel's into a shared
+// page (read() into it), and nothing of the other's.
+void
+cowfork(char *s)
+{
+  enum { N = 64, PAGE = 4096 };
+  int fds[2], xstatus;
+
+  char *a = sbrk(N*PAGE);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(int i = 0; i < N; i++)
+    a[i*PAGE] = 'p';
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+
+  int pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(int i = 0; i < N; i += 2)
+      a[i*PAGE] = 'c';
+    if(read(fds[0], a + PAGE + 1, 1) != 1 || a[PAGE + 1] != 'x'){
+      printf("%s: read into a shared page failed\n", s);
+      exit(1);
+    }
+    for(int i = 0; i < N; i++){
+      if(a[i*PAGE] != (i % 2 == 0 ? 'c' : 'p')){
+        printf("%s: child sees the wrong page %d\n", s, i);
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+
+  for(int i = 1; i < N; i += 2)
+    a[i*PAGE] = 'q';
+  write(fds[1], "x", 1);
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+  for(int i = 0; i < N; i++){
+    if(a[i*PAGE] != (i % 2 == 0 ? 'p' : 'q') || a[i*PAGE + 1] != 0){
+      printf("%s: parent sees the wrong page %d\n", s, i);
+      exit(1);
+    }
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// sbrk() memory is mapped on first use: a big heap costs
+// nothing until touched, the kernel can read and write the
+// untouched part, and fork() and sbrk(-n) cope with the holes.
+void
+lazysbrk(char *s)
+{
+  enum { BIG = 64*1024*1024, PAGE = 4096 };
+  struct buddy_stats before, after;
+  int fds[2], xstatus;
+  char buf[8];
+
+  if(memstat(&before) < 0){
+    printf("%s: memstat failed\n", s);
+    exit(1);
+  }
+  char *a = sbrk(BIG);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  a[BIG/2] = 1;
+  memstat(&after);
+  // the touch may map a whole 2 MB megapage
+  if(before.free > after.free + 512 + 64){
+    printf("%s: sbrk took %l pages\n", s, before.free - after.free);
+    exit(1);
+  }
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  // copyin from and copyout to pages nobody touched
+  if(write(fds[1], a + 3*PAGE, sizeof(buf)) != sizeof(buf) ||
+     read(fds[0], a + BIG - PAGE, sizeof(buf)) != sizeof(buf)){
+    printf("%s: copy to or from an untouched page failed\n", s);
+    exit(1);
+  }
+  for(int i = 0; i < sizeof(buf); i++){
+    if(a[BIG - PAGE + i] != 0){
+      printf("%s: untouched page not zero\n", s);
+      exit(1);
+    }
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  int pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(a[BIG/2] != 1 || a[BIG/4] != 0){
+      printf("%s: child sees the wrong heap\n", s);
+      exit(1);
+    }
+    a[BIG/4] = 2;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+  if(a[BIG/4] != 0){
+    printf("%s: child's store reached the parent\n", s);
+    exit(1);
+  }
+
+  if(sbrk(-BIG) != a + BIG){
+    printf("%s: sbrk(-n) failed\n", s);
+    exit(1);
+  }
+}
+
+// The file of a running program cannot be written: this one's
+// own. Should the write go through anyway, it writes back the
+// byte that is there.
+void
+textbusy(char *s)
+{
+  char c;
+
+  int fd1 = open("usertests", O_RDONLY);
+  if(fd1 < 0)
+    return;  // not run from the root directory
+  int fd2 = open("usertests", O_WRONLY);
+  if(fd2 < 0 || read(fd1, &c, 1) != 1){
+    printf("%s: open or read of usertests failed\n", s);
+    exit(1);
+  }
+  if(write(fd2, &c, 1) != -1){
+    printf("%s: wrote to a running program\n", s);
+    exit(1);
+  }
+  close(fd1);
+  close(fd2);
+}
+
+// A page of data that nothing but selfread touches, so that it is
+// still in the file when the test runs.
+char selfpage[4096] __attribute__((aligned(4096))) = { [0 ... 4095] = 's' };
+
+// read() of this program's file into a page of its data that is
+// not paged in yet, from the file offset that page comes from:
+// the read must not wait on itself paging the page in.
+void
+selfread(char *s)
+{
+  struct elfhdr elf;
+  struct proghdr ph;
+  char buf[512];
+  uint64 off = 0, pos;
+  int i, n;
+
+  int fd = open("usertests", O_RDONLY);
+  if(fd < 0)
+    return;  // not run from the root directory
+  if(read(fd, &elf, sizeof(elf)) != sizeof(elf) || elf.magic != ELF_MAGIC){
+    printf("%s: cannot read the ELF header\n", s);
+    exit(1);
+  }
+  pos = sizeof(elf);
+  for(i = 0; i < elf.phnum; i++){
+    for(; pos < elf.phoff + i*sizeof(ph); pos += n){
+      n = elf.phoff + i*sizeof(ph) - pos;
+      if((n = read(fd, buf, n < sizeof(buf) ? n : sizeof(buf))) <= 0)
+        break;
+    }
+    if(read(fd, &ph, sizeof(ph)) != sizeof(ph))
+      break;
+    pos += sizeof(ph);
+    if(ph.type == ELF_PROG_LOAD && ph.vaddr <= (uint64)selfpage &&
+       (uint64)selfpage + sizeof(selfpage) <= ph.vaddr + ph.filesz)
+      off = ph.off + (uint64)selfpage - ph.vaddr;
+  }
+  if(off == 0){
+    printf("%s: selfpage is not in the file\n", s);
+    exit(1);
+  }
+  for(; pos < off; pos += n){
+    n = off - pos < sizeof(buf) ? off - pos : sizeof(buf);
+    if((n = read(fd, buf, n)) <= 0){
+      printf("%s: read of usertests failed\n", s);
+      exit(1);
+    }
+  }
+  if(read(fd, selfpage, sizeof(selfpage)) != sizeof(selfpage)){
+    printf("%s: read into selfpage failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < sizeof(selfpage); i++){
+    if(selfpage[i] != 's'){
+      printf("%s: selfpage[%d] is %d\n", s, i, selfpage[i]);
+      exit(1);
+    }
+  }
+  close(fd);
+}
+
+// A heap with 2 MB aligned stretches gets megapages: data must
+// survive fork() and a store in the child, and sbrk(-n) to the
+// middle of one must keep the part below and give back zeroes
+// when the heap grows again. So must sbrk(-n) into the data of
+// the program.
+void
+megapages(char *s)
+{
+  enum { MEGA = 2*1024*1024, PAGE = 4096 };
+  int xstatus;
+
+  char *top = sbrk(0);
+  char *a = (char*)(((uint64)top + MEGA - 1) & ~(uint64)(MEGA - 1));
+  if(sbrk(a + 2*MEGA - top) == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(int i = 0; i < 2*MEGA; i += PAGE)
+    a[i] = i / PAGE;
+
+  int pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    a[3*PAGE] = 'c';
+    for(int i = 0; i < 2*MEGA; i += PAGE){
+      if(a[i] != (i == 3*PAGE ? 'c' : (char)(i / PAGE))){
+        printf("%s: child sees the wrong page %d\n", s, i / PAGE);
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+  a[5*PAGE] = 'p';
+  for(int i = 0; i < 2*MEGA; i += PAGE){
+    if(a[i] != (i == 5*PAGE ? 'p' : (char)(i / PAGE))){
+      printf("%s: parent sees the wrong page %d\n", s, i / PAGE);
+      exit(1);
+    }
+  }
+
+  // cut the second megapage in half
+  if(sbrk(-(MEGA/2)) == (char*)0xffffffffffffffffL ||
+     sbrk(MEGA/2) == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(int i = MEGA; i < 2*MEGA; i += PAGE){
+    if(a[i] != (i < MEGA + MEGA/2 ? (char)(i / PAGE) : 0)){
+      printf("%s: wrong page %d after shrinking\n", s, i / PAGE);
+      exit(1);
+    }
+  }
+
+  if(sbrk(-(a + 2*MEGA - top)) != a + 2*MEGA){
+    printf("%s: sbrk(-n) failed\n", s);
+    exit(1);
+  }
+
+  // shrink into the program's data and grow back: selfpage must
+  // come back zeroed, not read in from the file again. The stack
+  // goes too, so the child does it all in registers.
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    uint64 n = sbrk(0) - selfpage;
+    asm volatile(
+      "neg a0, %0\n"
+      "li a7, %1\n"
+      "ecall\n"           // sbrk(-n)
+      "mv a0, %0\n"
+      "li a7, %1\n"
+      "ecall\n"           // sbrk(n)
+      "lbu a0, 0(%2)\n"
+      "li a7, %3\n"
+      "ecall\n"           // exit(selfpage[0])
+      : : "r"(n), "i"(SYS_sbrk), "r"(selfpage), "i"(SYS_exit)
+      : "a0", "a7", "memory");
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: data page not zero after shrinking, status %d\n", s, xstatus);
+    exit(1);
+  }
+}
+
 struct test {
   void (*f)(char *);
   char *s;
@@ -2635,6 +2948,11 @@ struct test {
   {sbrklast, "sbrklast"},
   {sbrk8000, "sbrk8000"},
   {badarg, "badarg" },
+  {cowfork, "cowfork"},
+  {lazysbrk, "lazysbrk"},
+  {megapages, "megapages"},
+  {textbusy, "textbusy"},
+  {selfread, "selfread"},
 
   { 0, 0},
 };
@@ -2924,6 +3242,175 @@ outofinodes(char *s)
   }
 }
 
+// Print what the allocator did between the memstat() calls that
+// filled *from and *to: the allocations, and how many times the
+// global buddy lock was taken rather than a per-CPU magazine
+// serving them.
+void
+lockreport(char *s, struct buddy_stats *from, struct buddy_stats *to)
+{
+  printf("%s:   %l allocs, %l buddy lock acquires, %l contended\n", s,
+         to->allocs - from->allocs, to->lock_acquires - from->lock_acquires,
+         (to->lock_contended + to->cpu_lock_contended) -
+         (from->lock_contended + from->cpu_lock_contended));
+}
+
+// sbrk() throughput for a few growth sizes, plus a check that
+// memory handed out in big blocks comes back zeroed and can be
+// returned in pieces other than the ones it was grown by.
+void
+sbrkbench(char *s)
+{
+  static int sizes[] = { 1, 16, 257, 1024 };   // pages
+  enum { ROUNDS = 64, PAGE = 4096 };
+  struct buddy_stats from, to;
+
+  for(int k = 0; k < sizeof(sizes)/sizeof(sizes[0]); k++){
+    int n = sizes[k];
+    memstat(&from);
+    int start = uptime();
+    for(int r = 0; r < ROUNDS; r++){
+      char *a = sbrk(n * PAGE);
+      if(a == (char*)0xffffffffffffffffL){
+        printf("%s: sbrk(%d pages) failed\n", s, n);
+        exit(1);
+      }
+      for(int i = 0; i < n; i++){
+        if(a[i * PAGE] != 0 || a[i * PAGE + PAGE - 1] != 0){
+          printf("%s: page %d of %d not zeroed\n", s, i, n);
+          exit(1);
+        }
+        a[i * PAGE] = 1;
+      }
+      if(r % 2 == 0){
+        sbrk(-n * PAGE);
+      } else {
+        // give it back a few pages at a time
+        for(int left = n; left > 0; left -= 3)
+          sbrk(-(left < 3 ? left : 3) * PAGE);
+      }
+    }
+    int ticks = uptime() - start;
+    memstat(&to);
+    printf("%s: %d x %d pages in %d ticks\n", s, ROUNDS, n, ticks);
+    lockreport(s, &from, &to);
+  }
+}
+
+// fork() cost for parents of a few sizes: the time for a fork
+// and exit, and the memory the child costs before and after it
+// has written every page.
+void
+forkbench(char *s)
+{
+  static int sizes[] = { 1, 256, 4096 };   // pages
+  enum { ROUNDS = 32, PAGE = 4096 };
+  struct buddy_stats before, forked, written, from, to;
+  int down[2], up[2];
+  char c;
+
+  for(int k = 0; k < sizeof(sizes)/sizeof(sizes[0]); k++){
+    int n = sizes[k];
+    char *a = sbrk(n * PAGE);
+    if(a == (char*)0xffffffffffffffffL){
+      printf("%s: sbrk(%d pages) failed\n", s, n);
+      exit(1);
+    }
+    for(int i = 0; i < n; i++)
+      a[i * PAGE] = 1;
+
+    memstat(&from);
+    int start = uptime();
+    for(int r = 0; r < ROUNDS; r++){
+      int pid = fork();
+      if(pid < 0){
+        printf("%s: fork failed\n", s);
+        exit(1);
+      }
+      if(pid == 0)
+        exit(0);
+      wait(0);
+    }
+    int ticks = uptime() - start;
+    memstat(&to);
+
+    if(pipe(down) < 0 || pipe(up) < 0 || memstat(&before) < 0){
+      printf("%s: pipe or memstat failed\n", s);
+      exit(1);
+    }
+    int pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      read(down[0], &c, 1);
+      for(int i = 0; i < n; i++)
+        a[i * PAGE] = 2;
+      write(up[1], "x", 1);
+      read(down[0], &c, 1);
+      exit(0);
+    }
+    memstat(&forked);
+    write(down[1], "x", 1);
+    read(up[0], &c, 1);
+    memstat(&written);
+    write(down[1], "x", 1);
+    wait(0);
+    close(down[0]);
+    close(down[1]);
+    close(up[0]);
+    close(up[1]);
+
+    printf("%s: %d pages: %d forks in %d ticks, child took %l pages, %l after writing\n",
+           s, n, ROUNDS, ticks, before.free - forked.free, before.free - written.free);
+    lockreport(s, &from, &to);
+    sbrk(-n * PAGE);
+  }
+}
+
+// exec() latency for a small and a big program: fork, exec and
+// exit of a program that quits in main(), its output thrown
+// away. Programs are paged in from the file as they run, so the
+// big one should cost little more than the small one.
+void
+execbench(char *s)
+{
+  static char *progs[][3] = {
+    { "echo", 0, 0 },
+    { "usertests", "-x", 0 },   // prints its usage and exits
+  };
+  enum { ROUNDS = 32 };
+  struct buddy_stats from, to;
+  int xstatus;
+
+  for(int k = 0; k < sizeof(progs)/sizeof(progs[0]); k++){
+    memstat(&from);
+    int start = uptime();
+    for(int r = 0; r < ROUNDS; r++){
+      int pid = fork();
+      if(pid < 0){
+        printf("%s: fork failed\n", s);
+        exit(1);
+      }
+      if(pid == 0){
+        close(1);
+        exec(progs[k][0], progs[k]);
+        exit(127);
+      }
+      wait(&xstatus);
+      if(xstatus == 127){
+        printf("%s: exec %s failed\n", s, progs[k][0]);
+        exit(1);
+      }
+    }
+    int ticks = uptime() - start;
+    memstat(&to);
+    printf("%s: %s: %d execs in %d ticks\n", s, progs[k][0], ROUNDS, ticks);
+    lockreport(s, &from, &to);
+  }
+}
+
 struct test slowtests[] = {
   {bigdir, "bigdir"},
   {manywrites, "manywrites"},
@@ -2931,6 +3418,9 @@ struct test slowtests[] = {
   {execout, "execout"},
   {diskfull, "diskfull"},
   {outofinodes, "outofinodes"},
+  {sbrkbench, "sbrkbench"},
+  {forkbench, "forkbench"},
+  {execbench, "execbench"},
     
   { 0, 0},
 };
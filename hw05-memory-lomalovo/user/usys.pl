@@ -37,3 +37,6 @@ entry("sbrk");
 entry("sleep");
 entry("uptime");
 entry("poweroff");
+entry("memstat");
+entry("allocbench");
+entry("allocsites");